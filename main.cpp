@@ -1,25 +1,46 @@
+#include <algorithm>
+#include <climits>
 #include <chrono>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
 #include <stdexcept>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <time.h>
+#include <unistd.h>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "lib/tinyxml2.h"
+#include "src/compiled_model.h"
+#include "src/constraint_layer.h"
+#include "src/daemon.h"
 #include "src/image.h"
+#include "src/image_cache.h"
+#include "src/image_writer.h"
 #include "src/imagemosaic_wfc.h"
+#include "src/model_cache.h"
 #include "src/multi_array.h"
 #include "src/overlapping_wfc.h"
 #include "src/simpletiled_wfc.h"
 #include "src/symmetry.h"
+#include "src/thread_pool.h"
+#include "src/voxel.h"
+#include "src/voxelmosaic_wfc.h"
 
 #define _DEBUG 1
 
+const char* CACHE_DIR = "cache";
+const size_t MODEL_CACHE_SIZE = 64; // Compiled models kept in memory
+const uint32_t FRAME_DELAY_MS = 20;
+
 using namespace std;
 using namespace tinyxml2;
 using namespace chrono;
@@ -33,6 +54,16 @@ const char* StringAttribute(XMLElement* elem, const char* name, const char* defa
 	return value;
 }
 
+// The format attribute of a sample overrides the one given on the command line
+ImageEncoding OutputEncoding(XMLElement* elem, ImageFormat default_format, const LoadedModel& loaded) {
+	ImageEncoding encoding;
+	const char* format = elem->Attribute("format");
+	encoding.format = format == nullptr ? default_format : ParseImageFormat(format);
+	encoding.compression_level = elem->IntAttribute("compression", 8);
+	encoding.palette = loaded.colors;
+	return encoding;
+}
+
 unordered_set<string> ReadSubsetNames(XMLElement* root_elem, const string& subset) {
 	unordered_set<string> subset_names;
 	XMLElement* subsets_elem = root_elem->FirstChildElement("subsets");
@@ -52,9 +83,17 @@ unordered_set<string> ReadSubsetNames(XMLElement* root_elem, const string& subse
 }
 
 unordered_map<string, Tile> ReadTiles(XMLElement* root_elem, const string& directory, const string& subset) {
-	unordered_map<string, Tile> tiles;
 	unordered_set<string> subset_names = ReadSubsetNames(root_elem, subset);
 
+	// Every image is listed first so they can be decoded together
+	struct TileEntry {
+		string name;
+		double weight;
+		Symmetry symmetry;
+		uint32_t first_image;
+	};
+	vector<TileEntry> entries;
+	vector<string> image_paths;
 	bool unique = root_elem->BoolAttribute("unique", false);
 	XMLElement* tiles_elem = root_elem->FirstChildElement("tiles");
 	XMLElement* tile_elem = tiles_elem->FirstChildElement("tile");
@@ -67,31 +106,34 @@ unordered_map<string, Tile> ReadTiles(XMLElement* root_elem, const string& direc
 
 		double weight = tile_elem->DoubleAttribute("weight", 1.0);
 		Symmetry symmetry(StringAttribute(tile_elem, "symmetry", "X")[0]);
-
+		entries.push_back({name, weight, symmetry, static_cast<uint32_t>(image_paths.size())});
 		if (unique) {
-			vector<Image> images;
-			for (uint32_t i = 0; i < symmetry.orientations(); i++) {
-				string image_path = directory + "/" + name + " " + to_string(i) + ".png";
-				Image image = LoadImage(image_path);
-				images.push_back(image);
-			}
-			Tile tile(images, symmetry, weight);
-			tiles.insert({name, tile});
-		} else {
-			string image_path = directory + "/" + name + ".png";
-			Image image = LoadImage(image_path);
-			Tile tile(image, symmetry, weight);
-			tiles.insert({name, tile});
-		}
+			for (uint32_t i = 0; i < symmetry.orientations(); i++)
+				image_paths.push_back(directory + "/" + name + " " + to_string(i) + ".png");
+		} else
+			image_paths.push_back(directory + "/" + name + ".png");
 		tile_elem = tile_elem->NextSiblingElement("tile");
 	}
+
+	vector<Image> images = ImageCache::global().load(image_paths);
+	unordered_map<string, Tile> tiles;
+	for (vector<TileEntry>::const_iterator it = entries.begin(); it != entries.end(); it++) {
+		if (unique) {
+			vector<Image> orientations(images.begin() + it->first_image,
+									   images.begin() + it->first_image + it->symmetry.orientations());
+			tiles.insert({it->name, Tile(orientations, it->symmetry, it->weight)});
+		} else
+			tiles.insert({it->name, Tile(images[it->first_image], it->symmetry, it->weight)});
+	}
 	return tiles;
 }
 
 unordered_map<string, ImageWeight> ReadImageWeight(XMLElement* root_elem, const string& directory, const string& subset) {
-	unordered_map<string, ImageWeight> tiles;
 	unordered_set<string> subset_names = ReadSubsetNames(root_elem, subset);
 
+	vector<string> names;
+	vector<double> weights;
+	vector<string> image_paths;
 	XMLElement* tiles_elem = root_elem->FirstChildElement("tiles");
 	XMLElement* tile_elem = tiles_elem->FirstChildElement("tile");
 	while (tile_elem != nullptr) {
@@ -101,13 +143,16 @@ unordered_map<string, ImageWeight> ReadImageWeight(XMLElement* root_elem, const
 			continue;
 		}
 
-		double weight = tile_elem->DoubleAttribute("weight", 1.0);
-		string image_path = directory + "/" + name + ".png";
-		Image image = LoadImage(image_path);
-		ImageWeight tile(image, weight);
-		tiles.insert({name, tile});
+		names.push_back(name);
+		weights.push_back(tile_elem->DoubleAttribute("weight", 1.0));
+		image_paths.push_back(directory + "/" + name + ".png");
 		tile_elem = tile_elem->NextSiblingElement("tile");
 	}
+
+	vector<Image> images = ImageCache::global().load(image_paths);
+	unordered_map<string, ImageWeight> tiles;
+	for (uint32_t i = 0; i < names.size(); i++)
+		tiles.insert({names[i], ImageWeight(images[i], weights[i])});
 	return tiles;
 }
 
@@ -142,16 +187,177 @@ vector<Neighbor> ReadNeighbors(XMLElement* root_elem) {
 	return neighbors;
 }
 
-void ReadSimpletiled(XMLElement* elem) {
-	string name = elem->Attribute("name");
-	string subset = StringAttribute(elem, "subset", "tiles");
-	uint32_t size = elem->UnsignedAttribute("size", 24);
-	uint32_t width = elem->UnsignedAttribute("width", size);
-	uint32_t height = elem->UnsignedAttribute("height", size);
-	bool periodic_output = elem->BoolAttribute("periodic", false);
-	uint32_t screenshots = elem->UnsignedAttribute("screenshots", 2);
+// Arithmetic of the entropies of the solvers, double unless the entry sets entropy="float" or "fixed"
+EntropyMode ReadEntropyMode(XMLElement* elem) {
+	return ParseEntropyMode(StringAttribute(elem, "entropy", "double"));
+}
+
+// Backing of the solver state, hugepages="advise" or "explicit" and prefault="true" help the largest outputs
+ArenaOptions ReadArenaOptions(XMLElement* elem) {
+	ArenaOptions memory;
+	memory.huge_pages = ParseHugePages(StringAttribute(elem, "hugepages", "none"));
+	memory.prefault = elem->BoolAttribute("prefault", false);
+	return memory;
+}
+
+// Reuses the model of a previous entry, request or run if its sources and options didn't change,
+// entries sharing a model only allocate their own grid
+LoadedModel LoadOrCompile(const string& name, ModelKey key, EntropyMode entropy,
+						  const function<CompiledModel()>& compile) {
+	static ModelCache loaded(MODEL_CACHE_SIZE);
+	key.add(static_cast<uint32_t>(entropy));
+	optional<LoadedModel> found = loaded.find(key.value());
+	if (found.has_value())
+		return found.value();
+
+	string model_path = CompiledModelPath(CACHE_DIR, name, key.value());
+	optional<CompiledModel> cached = LoadCompiledModel(model_path, key.value());
+	shared_ptr<const CompiledModel> model;
+	if (cached.has_value())
+		model = make_shared<const CompiledModel>(move(cached.value()));
+	else {
+		CompiledModel compiled = compile();
+		compiled.entropy = entropy;
+		model = make_shared<const CompiledModel>(move(compiled));
+		try {
+			SaveCompiledModel(model_path, key.value(), *model);
+		} catch (const exception& e) {
+			printf("[Warning] %s\n", e.what());
+		}
+	}
+	shared_ptr<const TileAtlas> atlas = model->images.empty() ? nullptr : make_shared<const TileAtlas>(model->images);
+	LoadedModel result = {model, make_shared<const Palette>(model->colors()), atlas};
+	loaded.insert(key.value(), result);
+	return result;
+}
+
+const uint32_t MAX_ATTEMPTS = 10;
+
+// Seeds drawn in advance, shared by consecutive screenshots as they would be by consecutive rand() calls
+struct SeedStream {
+	vector<int> values;
+	size_t next = 0;
+	int get() {
+		return values.at(next++);
+	}
+};
+
+// Receives every solved image with the seed it was solved with
+using ImageOutput = function<void(int, Image&&)>;
+
+struct Screenshot {
+	uint32_t sample;
+	uint32_t index;
+	string log; // Printed in config order
+	uint32_t attempts;
+	double seconds;
+	double render_time;
+	bool done;
+};
+
+// An entry of the config file with a model ready to solve
+struct Sample {
+	string name;
+	uint32_t screenshots;
+	uint32_t patterns;
+	size_t cells;
+	ImageEncoding encoding;
+	bool tiled;   // Reports its render time
+	bool reseeds; // Restarts the random sequence at each screenshot when debugging
+	optional<uint32_t> seed; // Of the first attempt, the attempts of the sample use consecutive seeds from it
+	// Builds a solver and solves the screenshot, called from the thread pool
+	function<void(Screenshot&, SeedStream&, const ImageOutput&)> solve;
+	Sample(const string& name, uint32_t screenshots, uint32_t patterns, size_t cells, const ImageEncoding& encoding)
+		: name(name), screenshots(screenshots), patterns(patterns), cells(cells), encoding(encoding), tiled(false),
+		  reseeds(true), seed(nullopt) {}
+	double cost() const {
+		return static_cast<double>(patterns) * cells;
+	}
+};
+
+string OutputPath(const Sample& sample, int seed) {
+	return "output/" + sample.name + "_" + to_string(seed) + "." + ImageFormatExtension(sample.encoding.format);
+}
+
+// The solve of the successful attempt is saved as output/<name>_<seed>.apng when animate is set
+struct Recording {
+	string name;
+	uint32_t frame_interval; // Observations per frame, 0 if not recorded
+};
+
+Recording ReadRecording(XMLElement* elem, const string& name) {
+	if (!elem->BoolAttribute("animate", false))
+		return {name, 0};
+	return {name, max(1u, elem->UnsignedAttribute("frameInterval", 1))};
+}
+
+// Tries the seeds until an attempt succeeds, attempt returns whether it did
+void AttemptSeeds(Screenshot& screenshot, SeedStream& seeds, const function<bool(int)>& attempt) {
+	string index = to_string(screenshot.index);
+	for (uint32_t k = 0; k < MAX_ATTEMPTS; k++) {
+		screenshot.attempts++;
+		if (attempt(seeds.get())) {
+			screenshot.log += "> " + index + " DONE\n";
+			return;
+		}
+		screenshot.log += "> " + index + " CONTRADICTION " + to_string(k) + "\n";
+	}
+	screenshot.log += "> " + index + " FAILED\n";
+}
 
-	printf("< %s\n", name.c_str());
+template <typename WFCType>
+void SolveScreenshot(WFCType& wfc, Screenshot& screenshot, SeedStream& seeds, const ImageOutput& output,
+					 const Recording& recording) {
+	if (recording.frame_interval > 0)
+		wfc.captureFrames(recording.frame_interval, FRAME_DELAY_MS);
+	AttemptSeeds(screenshot, seeds, [&](int seed) {
+		optional<Image> success = wfc.execute(seed);
+		if (!success.has_value())
+			return false;
+		if (recording.frame_interval > 0)
+			wfc.saveAnimation("output/" + recording.name + "_" + to_string(seed) + ".apng");
+		output(seed, move(success.value()));
+		return true;
+	});
+}
+
+// Rules of the constraint layer of an entry, <constraint color="RRGGBB" tiles="name, name orientation"/> children,
+// with value instead of color for CSV layers and exclude instead of tiles to allow every other tile
+vector<ConstraintRule> ReadConstraintRules(XMLElement* elem) {
+	vector<ConstraintRule> rules;
+	XMLElement* rule_elem = elem->FirstChildElement("constraint");
+	while (rule_elem != nullptr) {
+		ConstraintRule rule;
+		rule.label = StringAttribute(rule_elem, "color", StringAttribute(rule_elem, "value", ""));
+		rule.exclude = rule_elem->Attribute("exclude") != nullptr;
+		string tiles = StringAttribute(rule_elem, rule.exclude ? "exclude" : "tiles", "");
+		size_t begin = 0;
+		while (begin <= tiles.size()) {
+			size_t end = min(tiles.find(',', begin), tiles.size());
+			if (tiles.find_first_not_of(' ', begin) < end)
+				rule.tiles.push_back(tiles.substr(begin, end - begin));
+			begin = end + 1;
+		}
+		rules.push_back(rule);
+		rule_elem = rule_elem->NextSiblingElement("constraint");
+	}
+	return rules;
+}
+
+// The constraints attribute names a layer painted over the output, compiled and propagated once
+// into the state every solver of the entry starts from, nullptr without one
+// The state only depends on the wave, so it is propagated by a bare solver without the rendering of the sample
+shared_ptr<const WFCState> ReadConstraints(XMLElement* elem, vec2 size, shared_ptr<const CompiledModel> model,
+										   const WFCOptions& options) {
+	const char* path = elem->Attribute("constraints");
+	if (path == nullptr)
+		return nullptr;
+	Array2D<uint8_t> allowed = CompileConstraintLayer(path, size, ReadConstraintRules(elem), *model);
+	WFC wfc(size, model, options.periodic_output, options.memory);
+	return wfc.setInitialConstraints(allowed);
+}
+
+CompiledModel CompileSimpletiled(const string& name, const string& subset) {
 	string config_file = "tilesets/" + name + ".xml";
 	XMLDocument rules_document;
 	if (rules_document.LoadFile(config_file.c_str()) != XML_SUCCESS)
@@ -159,12 +365,14 @@ void ReadSimpletiled(XMLElement* elem) {
 
 	uint32_t index = 0;
 	vector<Tile> tiles;
+	vector<string> names;
 	unordered_map<string, uint32_t> tile_indices;
 	XMLElement* root_elem = rules_document.FirstChildElement("set");
 	unordered_map<string, Tile> tiles_map = ReadTiles(root_elem, "tilesets/" + name, subset);
 	for (unordered_map<string, Tile>::const_iterator it = tiles_map.begin(); it != tiles_map.end(); it++) {
 		tile_indices.insert({it->first, index});
 		tiles.push_back(it->second);
+		names.push_back(it->first);
 		index++;
 	}
 
@@ -183,80 +391,84 @@ void ReadSimpletiled(XMLElement* elem) {
 		neighbors_indices.push_back(neighbor_index);
 	}
 
+	CompiledModel model = SimpletiledWFC::compile(tiles, neighbors_indices);
+	model.names = names;
+	return model;
+}
+
+Sample ReadSimpletiled(XMLElement* elem, ImageFormat default_format) {
+	string name = elem->Attribute("name");
+	string subset = StringAttribute(elem, "subset", "tiles");
+	uint32_t size = elem->UnsignedAttribute("size", 24);
+	uint32_t width = elem->UnsignedAttribute("width", size);
+	uint32_t height = elem->UnsignedAttribute("height", size);
 	WFCOptions options;
-	options.periodic_output = periodic_output;
-	SimpletiledWFC wfc(vec2(height, width), tiles, neighbors_indices, options);
-	for (uint32_t i = 0; i < screenshots; i++) {
-#ifdef _DEBUG
-		srand(i);
-#endif
-		bool failed = true;
-		for (uint32_t k = 0; k < 10; k++) {
-			int seed = rand();
-			optional<Image> success = wfc.execute(seed);
-			if (success.has_value()) {
-				SaveImagePNG("output/" + name + "_" + to_string(seed) + ".png", success.value());
-				printf("> %d DONE\n", i);
-				failed = false;
-				break;
-			}
-			printf("> %d CONTRADICTION %d\n", i, k);
-		}
-		if (failed)
-			printf("> %d FAILED\n", i);
-	}
+	options.periodic_output = elem->BoolAttribute("periodic", false);
+	options.memory = ReadArenaOptions(elem);
+
+	ModelKey key;
+	key.add(string("simpletiled"));
+	key.addFile("tilesets/" + name + ".xml");
+	key.addDirectory("tilesets/" + name);
+	key.add(subset);
+	LoadedModel loaded =
+		LoadOrCompile(name, key, ReadEntropyMode(elem), [&]() { return CompileSimpletiled(name, subset); });
+	shared_ptr<const CompiledModel> model = loaded.model;
+	shared_ptr<const TileAtlas> atlas = loaded.atlas;
+
+	Sample sample(name, elem->UnsignedAttribute("screenshots", 2), model->size(), height * width,
+				  OutputEncoding(elem, default_format, loaded));
+	sample.tiled = true;
+	Recording recording = ReadRecording(elem, name);
+	shared_ptr<const WFCState> constraints = ReadConstraints(elem, vec2(height, width), model, options);
+	sample.solve = [=](Screenshot& screenshot, SeedStream& seeds, const ImageOutput& output) {
+		SimpletiledWFC wfc(vec2(height, width), model, atlas, options);
+		wfc.setConstraints(constraints);
+		SolveScreenshot(wfc, screenshot, seeds, output, recording);
+		screenshot.render_time = wfc.renderTime();
+	};
+	return sample;
 }
 
-void ReadOverlapping(XMLElement* elem) {
+Sample ReadOverlapping(XMLElement* elem, ImageFormat default_format) {
 	string name = elem->Attribute("name");
 	uint32_t size = elem->UnsignedAttribute("size", 48);
 	uint32_t height = elem->UnsignedAttribute("height", size);
 	uint32_t width = elem->UnsignedAttribute("width", size);
-	uint32_t screenshots = elem->UnsignedAttribute("screenshots", 2);
 
 	OverlappingWFCOptions options;
 	options.ground = elem->BoolAttribute("ground", false);
 	options.periodic_input = elem->BoolAttribute("periodicInput", true);
 	options.periodic_output = elem->BoolAttribute("periodic", false);
+	options.memory = ReadArenaOptions(elem);
 	options.out_size = vec2(height, width);
 	options.symmetry = elem->UnsignedAttribute("symmetry", 8);
 	options.pattern_size = elem->UnsignedAttribute("N", 3);
 
-	printf("< %s\n", name.c_str());
 	string image_path = "samples/" + name + ".png";
-	Image image = LoadImage(image_path);
-	OverlappingWFC wfc(image, options);
-	for (uint32_t i = 0; i < screenshots; i++) {
-#ifdef _DEBUG
-		srand(i);
-#endif
-		bool failed = true;
-		for (uint32_t k = 0; k < 10; k++) {
-			int seed = rand();
-			optional<Image> success = wfc.execute(seed);
-			if (success.has_value()) {
-				SaveImagePNG("output/" + name + "_" + to_string(seed) + ".png", success.value());
-				printf("> %d DONE\n", i);
-				failed = false;
-				break;
-			}
-			printf("> %d CONTRADICTION %d\n", i, k);
-		}
-		if (failed)
-			printf("> %d FAILED\n", i);
-	}
-}
+	ModelKey key;
+	key.add(string("overlapping"));
+	key.addFile(image_path);
+	key.add(options.pattern_size);
+	key.add(options.symmetry);
+	key.add(options.periodic_input);
+	LoadedModel loaded = LoadOrCompile(name, key, ReadEntropyMode(elem), [&]() {
+		return OverlappingWFC::compile(ImageCache::global().load(image_path), options);
+	});
+	shared_ptr<const CompiledModel> model = loaded.model;
 
-void ReadImagemosaic(XMLElement* elem) {
-	string name = elem->Attribute("name");
-	string subset = StringAttribute(elem, "subset", "tiles");
-	uint32_t size = elem->UnsignedAttribute("size", 24);
-	uint32_t width = elem->UnsignedAttribute("width", size);
-	uint32_t height = elem->UnsignedAttribute("height", size);
-	bool periodic_output = elem->BoolAttribute("periodic", false);
-	uint32_t screenshots = elem->UnsignedAttribute("screenshots", 2);
+	vec2 wave_size = options.getWaveSize();
+	Sample sample(name, elem->UnsignedAttribute("screenshots", 2), model->size(),
+				  wave_size.height() * wave_size.width(), OutputEncoding(elem, default_format, loaded));
+	Recording recording = ReadRecording(elem, name);
+	sample.solve = [=](Screenshot& screenshot, SeedStream& seeds, const ImageOutput& output) {
+		OverlappingWFC wfc(model, options);
+		SolveScreenshot(wfc, screenshot, seeds, output, recording);
+	};
+	return sample;
+}
 
-	printf("< %s\n", name.c_str());
+CompiledModel CompileImagemosaic(const string& name, const string& subset) {
 	string config_file = "resources/" + name + ".xml";
 	XMLDocument rules_document;
 	if (rules_document.LoadFile(config_file.c_str()) != XML_SUCCESS)
@@ -264,6 +476,7 @@ void ReadImagemosaic(XMLElement* elem) {
 
 	uint32_t index = 0;
 	vector<ImageWeight> tiles;
+	vector<string> names;
 	unordered_map<string, uint32_t> tile_indices;
 	XMLElement* root_elem = rules_document.FirstChildElement("set");
 	unordered_map<string, ImageWeight> tiles_map = ReadImageWeight(root_elem, "resources/" + name, subset);
@@ -271,10 +484,11 @@ void ReadImagemosaic(XMLElement* elem) {
 		tile_indices.insert({it->first, index});
 		//printf("[INFO] %d: %s\n", index, it->first.c_str());
 		tiles.push_back(it->second);
+		names.push_back(it->first);
 		index++;
 	}
 
-	Array3D<uint8_t> neighbors(Propagator::DIRECTIONS, tiles_map.size(), tiles_map.size());
+	Array3D<uint8_t> neighbors(Topology::DIRECTIONS, tiles_map.size(), tiles_map.size());
 	neighbors.fill(false);
 	XMLElement* neighbors_elem = root_elem->FirstChildElement("neighbors");
 	XMLElement* tile_elem = neighbors_elem->FirstChildElement("tile");
@@ -302,59 +516,517 @@ void ReadImagemosaic(XMLElement* elem) {
 		tile_elem = tile_elem->NextSiblingElement("tile");
 	}
 
+	CompiledModel model = ImagemosaicWFC::compile(tiles, neighbors);
+	model.names = names;
+	return model;
+}
+
+Sample ReadImagemosaic(XMLElement* elem, ImageFormat default_format) {
+	string name = elem->Attribute("name");
+	string subset = StringAttribute(elem, "subset", "tiles");
+	uint32_t size = elem->UnsignedAttribute("size", 24);
+	uint32_t width = elem->UnsignedAttribute("width", size);
+	uint32_t height = elem->UnsignedAttribute("height", size);
 	WFCOptions options;
-	options.periodic_output = periodic_output;
-	ImagemosaicWFC wfc(vec2(height, width), tiles, neighbors, options);
-	for (uint32_t i = 0; i < screenshots; i++) {
-		bool failed = true;
-		for (uint32_t k = 0; k < 10; k++) {
-			int seed = rand();
-			optional<Image> success = wfc.execute(seed);
-			if (success.has_value()) {
-				SaveImagePNG("output/" + name + "_" + to_string(seed) + ".png", success.value());
-				printf("> %d DONE\n", i);
-				failed = false;
-				break;
-			}
-			printf("> %d CONTRADICTION %d\n", i, k);
+	options.periodic_output = elem->BoolAttribute("periodic", false);
+	options.memory = ReadArenaOptions(elem);
+
+	ModelKey key;
+	key.add(string("imagemosaic"));
+	key.addFile("resources/" + name + ".xml");
+	key.addDirectory("resources/" + name);
+	key.add(subset);
+	LoadedModel loaded =
+		LoadOrCompile(name, key, ReadEntropyMode(elem), [&]() { return CompileImagemosaic(name, subset); });
+	shared_ptr<const CompiledModel> model = loaded.model;
+	shared_ptr<const TileAtlas> atlas = loaded.atlas;
+
+	Sample sample(name, elem->UnsignedAttribute("screenshots", 2), model->size(), height * width,
+				  OutputEncoding(elem, default_format, loaded));
+	sample.tiled = true;
+	sample.reseeds = false;
+	Recording recording = ReadRecording(elem, name);
+	shared_ptr<const WFCState> constraints = ReadConstraints(elem, vec2(height, width), model, options);
+	sample.solve = [=](Screenshot& screenshot, SeedStream& seeds, const ImageOutput& output) {
+		ImagemosaicWFC wfc(vec2(height, width), model, atlas, options);
+		wfc.setConstraints(constraints);
+		SolveScreenshot(wfc, screenshot, seeds, output, recording);
+		screenshot.render_time = wfc.renderTime();
+	};
+	return sample;
+}
+
+struct VoxelTileset {
+	vector<VoxelWeight> tiles; // In config order
+	Array3D<uint8_t> neighbors;
+	optional<uint32_t> ground;
+};
+
+// Parses the .vox files of the tiles of the subset of resources/<name>.xml, indexed by tile name
+vector<VoxelWeight> ReadVoxelTiles(XMLElement* root_elem, const string& name, const string& subset,
+								   unordered_map<string, uint32_t>& tile_indices) {
+	unordered_set<string> subset_names = ReadSubsetNames(root_elem, subset);
+	vector<VoxelWeight> tiles;
+	XMLElement* tile_elem = root_elem->FirstChildElement("tiles")->FirstChildElement("tile");
+	while (tile_elem != nullptr) {
+		string tile_name = tile_elem->Attribute("name");
+		if (subset_names.size() == 0 || subset_names.find(tile_name) != subset_names.end()) {
+			tile_indices.insert({tile_name, tiles.size()});
+			tiles.push_back(VoxelWeight(LoadVoxelModel("resources/" + name + "/" + tile_name + ".vox"),
+										tile_elem->DoubleAttribute("weight", 1.0)));
 		}
-		if (failed)
-			printf("> %d FAILED\n", i);
+		tile_elem = tile_elem->NextSiblingElement("tile");
 	}
+	return tiles;
 }
 
-void ReadConfigFile(const string& config_path) {
+// The set element of resources/<name>.xml
+XMLElement* LoadVoxelRules(XMLDocument& rules_document, const string& name) {
+	string config_file = "resources/" + name + ".xml";
+	if (rules_document.LoadFile(config_file.c_str()) != XML_SUCCESS)
+		throw runtime_error(config_file + " not found");
+	return rules_document.FirstChildElement("set");
+}
+
+// Rules of resources/<name>.xml, tiles are the .vox files of resources/<name>
+// Neighbors are given along front, left, right, back, down and up, the ground tile fills the bottom layer
+VoxelTileset ReadVoxelTileset(const string& name, const string& subset) {
+	XMLDocument rules_document;
+	XMLElement* root_elem = LoadVoxelRules(rules_document, name);
+	unordered_map<string, uint32_t> tile_indices;
+	vector<VoxelWeight> tiles = ReadVoxelTiles(root_elem, name, subset, tile_indices);
+
+	const char* DIRECTION_NAMES[] = {"front", "left", "right", "back", "down", "up"};
+	Array3D<uint8_t> neighbors(Topology::VOXEL_DIRECTIONS, tiles.size(), tiles.size());
+	neighbors.fill(false);
+	XMLElement* tile_elem = root_elem->FirstChildElement("neighbors")->FirstChildElement("tile");
+	for (; tile_elem != nullptr; tile_elem = tile_elem->NextSiblingElement("tile")) {
+		unordered_map<string, uint32_t>::const_iterator first = tile_indices.find(tile_elem->Attribute("name"));
+		if (first == tile_indices.end())
+			continue;
+		XMLElement* neighbor_elem = tile_elem->FirstChildElement("neighbor");
+		for (; neighbor_elem != nullptr; neighbor_elem = neighbor_elem->NextSiblingElement("neighbor")) {
+			unordered_map<string, uint32_t>::const_iterator second = tile_indices.find(neighbor_elem->Attribute("name"));
+			if (second == tile_indices.end())
+				continue;
+			for (uint32_t dir = 0; dir < Topology::VOXEL_DIRECTIONS; dir++)
+				neighbors(dir, first->second, second->second) = neighbor_elem->BoolAttribute(DIRECTION_NAMES[dir]);
+		}
+	}
+
+	optional<uint32_t> ground;
+	const char* ground_name = root_elem->Attribute("ground");
+	if (ground_name != nullptr && tile_indices.find(ground_name) != tile_indices.end())
+		ground = tile_indices[ground_name];
+	return {tiles, neighbors, ground};
+}
+
+// Voxels of the tiles of an entry, parsed once by whichever needs them first: compiling the model, or the first
+// screenshot to render when the model comes from the cache
+struct LazyVoxelTiles {
+	once_flag loaded;
+	shared_ptr<const vector<VoxelModel>> models; // Share a palette
+	void set(const vector<VoxelWeight>& tiles) {
+		vector<VoxelModel> shared;
+		for (vector<VoxelWeight>::const_iterator it = tiles.begin(); it != tiles.end(); it++)
+			shared.push_back(it->model);
+		SharePalette(shared);
+		models = make_shared<const vector<VoxelModel>>(move(shared));
+	}
+};
+
+// Outputs are voxel models saved as output/<name>_<seed>.vox, or .rgba with format="raw"
+Sample ReadVoxelmosaic(XMLElement* elem) {
+	string name = elem->Attribute("name");
+	string subset = StringAttribute(elem, "subset", "tiles");
+	uint32_t size = elem->UnsignedAttribute("size", 8);
+	uint32_t width = elem->UnsignedAttribute("width", size);
+	uint32_t depth = elem->UnsignedAttribute("depth", size);
+	uint32_t height = elem->UnsignedAttribute("height", size);
+	VoxelFormat format = ParseVoxelFormat(StringAttribute(elem, "format", "vox"));
+	WFCOptions options;
+	options.periodic_output = elem->BoolAttribute("periodic", false);
+	options.memory = ReadArenaOptions(elem);
+
+	ModelKey key;
+	key.add(string("voxelmosaic"));
+	key.addFile("resources/" + name + ".xml");
+	key.addDirectory("resources/" + name);
+	key.add(subset);
+	shared_ptr<LazyVoxelTiles> tiles = make_shared<LazyVoxelTiles>();
+	LoadedModel loaded = LoadOrCompile(name, key, ReadEntropyMode(elem), [&]() {
+		VoxelTileset tileset = ReadVoxelTileset(name, subset);
+		call_once(tiles->loaded, [&]() { tiles->set(tileset.tiles); });
+		return VoxelmosaicWFC::compile(tileset.tiles, tileset.neighbors, tileset.ground);
+	});
+	shared_ptr<const CompiledModel> model = loaded.model;
+
+	// The y axis of the voxels is the rows of the wave and z its layers
+	vec3 wave_size(depth, width, height);
+	ImageEncoding encoding = {ImageFormat::PNG, 8, loaded.colors}; // Unused, nothing is sent to the image writer
+	Sample sample(name, elem->UnsignedAttribute("screenshots", 2), model->size(), wave_size.volume(), encoding);
+	sample.tiled = true;
+	sample.solve = [=](Screenshot& screenshot, SeedStream& seeds, const ImageOutput&) {
+		call_once(tiles->loaded, [&]() {
+			XMLDocument rules_document;
+			unordered_map<string, uint32_t> tile_indices;
+			tiles->set(ReadVoxelTiles(LoadVoxelRules(rules_document, name), name, subset, tile_indices));
+		});
+		VoxelmosaicWFC wfc(wave_size, model, tiles->models, options);
+		AttemptSeeds(screenshot, seeds, [&](int seed) {
+			optional<VoxelModel> success = wfc.execute(seed);
+			if (success.has_value())
+				SaveVoxelModel("output/" + name + "_" + to_string(seed) + "." + VoxelFormatExtension(format),
+							   success.value(), format);
+			return success.has_value();
+		});
+		screenshot.render_time = wfc.renderTime();
+	};
+	return sample;
+}
+
+// Entries with a seed get the same outputs on every run, whatever their place in the config
+optional<uint32_t> ReadSeed(XMLElement* elem) {
+	if (elem->Attribute("seed") == nullptr)
+		return nullopt;
+	return elem->UnsignedAttribute("seed");
+}
+
+vector<Sample> ReadConfigFile(const string& config_path, ImageFormat default_format) {
 	XMLDocument document;
 	if (document.LoadFile(config_path.c_str()) != XML_SUCCESS)
 		throw runtime_error(config_path + " not found");
+	vector<Sample> samples;
 	XMLElement* root_elem = document.FirstChildElement("samples");
 	XMLElement* elem;
 	elem = root_elem->FirstChildElement("simpletiled");
 	while (elem != nullptr) {
-		ReadSimpletiled(elem);
+		samples.push_back(ReadSimpletiled(elem, default_format));
+		samples.back().seed = ReadSeed(elem);
 		elem = elem->NextSiblingElement("simpletiled");
 	}
 	elem = root_elem->FirstChildElement("overlapping");
 	while (elem != nullptr) {
-		ReadOverlapping(elem);
+		samples.push_back(ReadOverlapping(elem, default_format));
+		samples.back().seed = ReadSeed(elem);
 		elem = elem->NextSiblingElement("overlapping");
 	}
 	elem = root_elem->FirstChildElement("imagemosaic");
 	while (elem != nullptr) {
-		ReadImagemosaic(elem);
+		samples.push_back(ReadImagemosaic(elem, default_format));
+		samples.back().seed = ReadSeed(elem);
 		elem = elem->NextSiblingElement("imagemosaic");
 	}
+	elem = root_elem->FirstChildElement("voxelmosaic");
+	while (elem != nullptr) {
+		samples.push_back(ReadVoxelmosaic(elem));
+		samples.back().seed = ReadSeed(elem);
+		elem = elem->NextSiblingElement("voxelmosaic");
+	}
+	return samples;
+}
+
+// Screenshots using the same random sequence, solved one after the other
+struct Task {
+	vector<Screenshot*> screenshots;
+	SeedStream seeds;
+	double cost;
+};
+
+// Splits the screenshots into tasks, each screenshot gets the seeds it would get if the samples were solved in order,
+// or consecutive seeds from the seed of its entry
+vector<Task> CreateTasks(const vector<Sample>& samples, vector<vector<Screenshot>>& screenshots) {
+	vector<Task> tasks;
+	for (uint32_t s = 0; s < samples.size(); s++)
+		for (uint32_t i = 0; i < samples[s].screenshots; i++) {
+#ifdef _DEBUG
+			bool reseeds = samples[s].reseeds;
+#else
+			bool reseeds = true;
+#endif
+			if (reseeds || tasks.empty())
+				tasks.push_back({{}, {}, 0});
+			tasks.back().screenshots.push_back(&screenshots[s][i]);
+			tasks.back().cost += samples[s].cost();
+		}
+
+	for (vector<Task>::iterator it = tasks.begin(); it != tasks.end(); it++) {
+		const Screenshot& first = *it->screenshots[0];
+		optional<uint32_t> seed = samples[first.sample].seed;
+		if (seed.has_value()) {
+			uint32_t start = seed.value() + first.index * MAX_ATTEMPTS;
+			for (uint32_t k = 0; k < MAX_ATTEMPTS * it->screenshots.size(); k++)
+				it->seeds.values.push_back(static_cast<int>((start + k) & INT_MAX));
+			continue;
+		}
+#ifdef _DEBUG
+		if (samples[first.sample].reseeds)
+			srand(first.index);
+#endif
+		for (uint32_t k = 0; k < MAX_ATTEMPTS * it->screenshots.size(); k++)
+			it->seeds.values.push_back(rand());
+	}
+	return tasks;
+}
+
+struct PrintCursor {
+	uint32_t sample;
+	uint32_t screenshot;
+	bool started;
+};
+
+// Prints the logs of the finished screenshots in config order, stops at the first unfinished one
+void PrintFinished(const vector<Sample>& samples, const vector<vector<Screenshot>>& screenshots, PrintCursor& cursor) {
+	while (cursor.sample < samples.size()) {
+		const Sample& sample = samples[cursor.sample];
+		const vector<Screenshot>& sample_screenshots = screenshots[cursor.sample];
+		if (!cursor.started) {
+			printf("< %s\n", sample.name.c_str());
+			cursor.started = true;
+		}
+		while (cursor.screenshot < sample_screenshots.size() && sample_screenshots[cursor.screenshot].done) {
+			fputs(sample_screenshots[cursor.screenshot].log.c_str(), stdout);
+			cursor.screenshot++;
+		}
+		if (cursor.screenshot < sample_screenshots.size())
+			return;
+		if (sample.tiled) {
+			double render_time = 0;
+			for (vector<Screenshot>::const_iterator it = sample_screenshots.begin(); it != sample_screenshots.end();
+				 it++)
+				render_time += it->render_time;
+			printf("render = %.3fms\n", 1000 * render_time);
+		}
+		cursor = {cursor.sample + 1, 0, false};
+	}
+}
+
+void SaveTimings(const string& path, const vector<Sample>& samples, const vector<vector<Screenshot>>& screenshots) {
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		printf("[Warning] Failed to write %s\n", path.c_str());
+		return;
+	}
+	fprintf(file, "sample screenshot patterns cells attempts seconds\n");
+	for (uint32_t s = 0; s < samples.size(); s++)
+		for (vector<Screenshot>::const_iterator it = screenshots[s].begin(); it != screenshots[s].end(); it++)
+			fprintf(file, "%s %u %u %zu %u %.3f\n", samples[s].name.c_str(), it->index, samples[s].patterns,
+					samples[s].cells, it->attempts, it->seconds);
+	fclose(file);
+}
+
+// Solves every screenshot on the thread pool, the most expensive tasks first
+void SolveSamples(const vector<Sample>& samples, ImageWriter& writer) {
+	vector<vector<Screenshot>> screenshots(samples.size());
+	for (uint32_t s = 0; s < samples.size(); s++)
+		for (uint32_t i = 0; i < samples[s].screenshots; i++)
+			screenshots[s].push_back({s, i, "", 0, 0, 0, false});
+	vector<Task> tasks = CreateTasks(samples, screenshots);
+	stable_sort(tasks.begin(), tasks.end(), [](const Task& a, const Task& b) { return a.cost > b.cost; });
+
+	mutex print_mutex;
+	PrintCursor cursor = {0, 0, false};
+	ThreadPool::global().parallelFor(tasks.size(), 1, [&](size_t t) {
+		Task& task = tasks[t];
+		for (vector<Screenshot*>::iterator it = task.screenshots.begin(); it != task.screenshots.end(); it++) {
+			Screenshot& screenshot = **it;
+			const Sample& sample = samples[screenshot.sample];
+			hrc::time_point start = hrc::now();
+			// Of screenshots with the same name and seed, the last one in config order is kept
+			uint64_t order = static_cast<uint64_t>(screenshot.sample) << 32 | screenshot.index;
+			sample.solve(screenshot, task.seeds, [&](int seed, Image&& image) {
+				writer.write(OutputPath(sample, seed), move(image), sample.encoding, order);
+			});
+			screenshot.seconds = duration<double>(hrc::now() - start).count();
+
+			lock_guard<mutex> lock(print_mutex);
+			screenshot.done = true;
+			PrintFinished(samples, screenshots, cursor);
+		}
+	});
+	PrintFinished(samples, screenshots, cursor);
+	SaveTimings("output/timings.txt", samples, screenshots);
+}
+
+// Request paths are relative and stay inside the directories they're looked up in
+bool IsContainedPath(const string& path) {
+	return !path.empty() && path[0] != '/' && path.find("..") == string::npos && path.find('\0') == string::npos;
+}
+
+// Builds the sample of a daemon request, an element named after the type of the sample
+Sample ReadRequest(XMLElement* elem) {
+	if (elem->Attribute("name") == nullptr)
+		throw invalid_argument("Missing sample name");
+	string name = elem->Attribute("name");
+	if (!IsContainedPath(name) || name.find('/') != string::npos)
+		throw invalid_argument("Invalid sample name: " + name);
+	if (elem->Attribute("constraints") != nullptr && !IsContainedPath(elem->Attribute("constraints")))
+		throw invalid_argument("Invalid constraints path: " + string(elem->Attribute("constraints")));
+	// One screenshot unless more are asked for
+	if (elem->Attribute("screenshots") == nullptr)
+		elem->SetAttribute("screenshots", 1);
+	string type = elem->Name();
+	if (type == "simpletiled")
+		return ReadSimpletiled(elem, ImageFormat::PNG);
+	if (type == "overlapping")
+		return ReadOverlapping(elem, ImageFormat::PNG);
+	if (type == "imagemosaic")
+		return ReadImagemosaic(elem, ImageFormat::PNG);
+	throw invalid_argument("Unknown sample type: " + type);
+}
+
+// Answers a daemon request, a JSON object or an XML element on one line, in the syntax of the request
+// A JSON request names its sample type with "type", the other members are the attributes of a config entry
+// Outputs are written to the output directory, or returned in base64 if inline is set
+string HandleRequest(const string& line) {
+	bool json = line[line.find_first_not_of(" \t")] == '{';
+	string id;
+	string error;
+	bool inline_output = false;
+	ImageFormat format = ImageFormat::PNG;
+	vector<string> outputs;
+	uint32_t attempts = 0;
+	uint32_t failed = 0;
+	try {
+		XMLDocument document;
+		XMLElement* elem;
+		if (json) {
+			vector<pair<string, string>> members = ParseJSONObject(line);
+			string type;
+			for (vector<pair<string, string>>::const_iterator it = members.begin(); it != members.end(); it++)
+				if (it->first == "type")
+					type = it->second;
+			if (type.empty())
+				throw invalid_argument("Missing sample type");
+			elem = document.NewElement(type.c_str());
+			document.InsertFirstChild(elem);
+			for (vector<pair<string, string>>::const_iterator it = members.begin(); it != members.end(); it++) {
+				// Attributes end at the first null character, which would cut the value short
+				if (it->second.find('\0') != string::npos)
+					throw invalid_argument("Null character in " + it->first);
+				if (it->first != "type")
+					elem->SetAttribute(it->first.c_str(), it->second.c_str());
+			}
+		} else {
+			if (document.Parse(line.c_str()) != XML_SUCCESS || document.RootElement() == nullptr)
+				throw invalid_argument("Malformed XML request");
+			elem = document.RootElement();
+		}
+		id = StringAttribute(elem, "id", "");
+		inline_output = elem->BoolAttribute("inline", false);
+		Sample sample = ReadRequest(elem);
+		format = sample.encoding.format;
+
+		// Attempts use consecutive seeds from the requested one, or random seeds
+		SeedStream seeds;
+		uint32_t count = MAX_ATTEMPTS * sample.screenshots;
+		if (elem->Attribute("seed") != nullptr) {
+			uint32_t first = elem->UnsignedAttribute("seed");
+			for (uint32_t k = 0; k < count; k++)
+				seeds.values.push_back(static_cast<int>((first + k) & INT_MAX));
+		} else {
+			random_device device;
+			for (uint32_t k = 0; k < count; k++)
+				seeds.values.push_back(static_cast<int>(device() & INT_MAX));
+		}
+
+		for (uint32_t i = 0; i < sample.screenshots; i++) {
+			Screenshot screenshot = {0, i, "", 0, 0, 0, false};
+			size_t solved = outputs.size();
+			sample.solve(screenshot, seeds, [&](int seed, Image&& image) {
+				if (inline_output) {
+					outputs.push_back(Base64Encode(EncodeImage(image, sample.encoding)));
+					return;
+				}
+				string path = OutputPath(sample, seed);
+				SaveImage(path, image, sample.encoding);
+				outputs.push_back(path);
+			});
+			attempts += screenshot.attempts;
+			if (outputs.size() == solved)
+				failed++;
+		}
+	} catch (const exception& e) {
+		error = e.what();
+	}
+
+	string status = !error.empty() ? "error" : failed > 0 ? "failed" : "done";
+	const char* output_name = inline_output ? "images" : "paths";
+	if (json) {
+		string response = "{\"id\":" + JSONString(id) + ",\"status\":" + JSONString(status);
+		if (!error.empty())
+			return response + ",\"error\":" + JSONString(error) + "}";
+		response += ",\"attempts\":" + to_string(attempts);
+		if (inline_output)
+			response += ",\"format\":" + JSONString(ImageFormatExtension(format));
+		response += ",\"" + string(output_name) + "\":[";
+		for (vector<string>::const_iterator it = outputs.begin(); it != outputs.end(); it++)
+			response += (it == outputs.begin() ? "" : ",") + JSONString(*it);
+		return response + "]}";
+	}
+	XMLPrinter printer(nullptr, true);
+	printer.OpenElement("result", true);
+	printer.PushAttribute("id", id.c_str());
+	printer.PushAttribute("status", status.c_str());
+	if (!error.empty())
+		printer.PushAttribute("error", error.c_str());
+	else {
+		printer.PushAttribute("attempts", attempts);
+		if (inline_output)
+			printer.PushAttribute("format", ImageFormatExtension(format));
+		for (vector<string>::const_iterator it = outputs.begin(); it != outputs.end(); it++) {
+			printer.OpenElement(inline_output ? "image" : "path", true);
+			printer.PushText(it->c_str());
+			printer.CloseElement(true);
+		}
+	}
+	printer.CloseElement(true);
+	return printer.CStr();
+}
+
+// Answers requests from stdin on stdout, or from the clients of a Unix domain socket
+int RunDaemon(const char* socket_path) {
+	fs::create_directories("output");
+	fs::create_directories(CACHE_DIR);
+	try {
+		Daemon daemon(max(1u, thread::hardware_concurrency()), HandleRequest);
+		if (socket_path != nullptr) {
+			daemon.listen(socket_path);
+			return 0;
+		}
+		// Answers get their own copy of stdout, warnings printed while solving go to stderr
+		int output = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+		daemon.serve(STDIN_FILENO, output);
+		close(output);
+	} catch (const exception& e) {
+		fprintf(stderr, "[Error] %s\n", e.what());
+		return 1;
+	}
+	return 0;
 }
 
 int main(int argc, char* argv[]) {
 	if (argc < 2) {
-		printf("Usage: %s <sampling file>\n", argv[0]);
+		printf("Usage: %s <sampling file> [png|ppm|qoi|raw]\n", argv[0]);
+		printf("       %s --daemon [socket path]\n", argv[0]);
 		return 1;
 	}
+	if (string(argv[1]) == "--daemon")
+		return RunDaemon(argc > 2 ? argv[2] : nullptr);
+	ImageFormat format = argc > 2 ? ParseImageFormat(argv[2]) : ImageFormat::PNG;
 	srand(time(NULL));
 	fs::create_directories("output");
+	fs::create_directories(CACHE_DIR);
 	hrc::time_point start = hrc::now();
-	ReadConfigFile(argv[1]);
+	{
+		// Bounded so finished images can't pile up faster than they are encoded
+		uint32_t threads = max(1u, thread::hardware_concurrency());
+		ImageWriter writer(threads, 2 * threads);
+		vector<Sample> samples = ReadConfigFile(argv[1], format);
+		SolveSamples(samples, writer);
+		writer.flush();
+	}
 	hrc::time_point end = hrc::now();
 	double elapsed = duration_cast<milliseconds>(end - start).count();
 	printf("time = %d.%03ds\n", (uint32_t)elapsed / 1000, (uint32_t)elapsed % 1000);
@@ -0,0 +1,69 @@
+#include "animation_writer.h"
+
+void AnimationWriter::work() {
+	while (true) {
+		unique_lock<mutex> lock(queue_mutex);
+		not_empty.wait(lock, [this] { return stopping || !frames.empty(); });
+		if (frames.empty())
+			return;
+		Frame frame = move(frames.front());
+		frames.pop_front();
+		encoding = true;
+		lock.unlock();
+
+		try {
+			if (frame.restart)
+				encoder.clear();
+			encoder.add(frame.i, frame.j, frame.region);
+		} catch (...) {
+			lock_guard<mutex> error_lock(queue_mutex);
+			if (!error)
+				error = current_exception();
+		}
+
+		lock.lock();
+		encoding = false;
+		if (frames.empty())
+			idle.notify_all();
+	}
+}
+
+AnimationWriter::AnimationWriter(uint32_t height, uint32_t width, uint32_t delay_ms, int compression_level)
+	: encoder(height, width, delay_ms, compression_level), stopping(false), encoding(false),
+	  worker(&AnimationWriter::work, this) {}
+
+AnimationWriter::~AnimationWriter() {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		stopping = true;
+		frames.clear();
+	}
+	not_empty.notify_one();
+	worker.join();
+}
+
+void AnimationWriter::add(uint32_t i, uint32_t j, Image&& region) {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		frames.push_back({i, j, move(region), false});
+	}
+	not_empty.notify_one();
+}
+
+void AnimationWriter::restart(Image&& frame) {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		// Frames that aren't compressed yet are dropped along with the others
+		frames.clear();
+		frames.push_back({0, 0, move(frame), true});
+	}
+	not_empty.notify_one();
+}
+
+void AnimationWriter::save(const string& path) {
+	unique_lock<mutex> lock(queue_mutex);
+	idle.wait(lock, [this] { return frames.empty() && !encoding; });
+	if (error)
+		rethrow_exception(error);
+	encoder.save(path);
+}
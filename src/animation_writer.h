@@ -0,0 +1,43 @@
+#ifndef ANIMATION_WRITER_H
+#define ANIMATION_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+#include "image.h"
+
+using namespace std;
+
+// Compresses the frames of an animation on a background thread while they are being produced
+class AnimationWriter {
+private:
+	struct Frame {
+		uint32_t i;
+		uint32_t j;
+		Image region;
+		bool restart; // Covers the whole animation and replaces the previous frames
+	};
+	APNGEncoder encoder;
+	bool stopping;
+	bool encoding;
+	mutex queue_mutex;
+	condition_variable not_empty;
+	condition_variable idle;
+	deque<Frame> frames;
+	exception_ptr error;
+	thread worker;
+	void work();
+public:
+	AnimationWriter(uint32_t height, uint32_t width, uint32_t delay_ms, int compression_level);
+	~AnimationWriter();
+	void add(uint32_t i, uint32_t j, Image&& region);
+	void restart(Image&& frame);
+	void save(const string& path); // Waits until every frame is compressed
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+// Size of the huge pages of x86-64 and arm64 with 4 KiB pages
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+static size_t roundUp(size_t value, size_t multiple) {
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+HugePages ParseHugePages(const string& name) {
+	if (name == "none")
+		return HugePages::NONE;
+	if (name == "advise")
+		return HugePages::ADVISE;
+	if (name == "explicit")
+		return HugePages::EXPLICIT;
+	throw invalid_argument("Unknown huge pages mode: " + name);
+}
+
+// Transparent huge pages need aligned 2 MiB ranges, so the mapping is made larger and trimmed to the alignment
+static uint8_t* mapAligned(size_t length, size_t alignment) {
+	size_t padded = length + alignment;
+	void* mapping = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+		throw bad_alloc();
+	uint8_t* start = static_cast<uint8_t*>(mapping);
+	uint8_t* aligned = start + (alignment - reinterpret_cast<uintptr_t>(start) % alignment) % alignment;
+	if (aligned != start)
+		munmap(start, aligned - start);
+	if (aligned + length != start + padded)
+		munmap(aligned + length, start + padded - (aligned + length));
+	return aligned;
+}
+
+// Faults every page in with one call rather than a trap per page on the first writes
+static void prefault(uint8_t* base, size_t length) {
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(base, length, MADV_POPULATE_WRITE) == 0)
+		return;
+#endif
+	size_t page = sysconf(_SC_PAGESIZE);
+	for (size_t offset = 0; offset < length; offset += page)
+		base[offset] = 0;
+}
+
+Arena::Arena(size_t capacity, const ArenaOptions& options) : base(nullptr), capacity(0), used(0), huge(false) {
+	if (capacity == 0)
+		return;
+	if (options.huge_pages == HugePages::NONE) {
+		this->capacity = roundUp(capacity, sysconf(_SC_PAGESIZE));
+		void* mapping = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED)
+			throw bad_alloc();
+		base = static_cast<uint8_t*>(mapping);
+	} else {
+		this->capacity = roundUp(capacity, HUGE_PAGE_SIZE);
+		if (options.huge_pages == HugePages::EXPLICIT) {
+			int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (options.prefault ? MAP_POPULATE : 0);
+			void* mapping = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE, flags, -1, 0);
+			if (mapping != MAP_FAILED) {
+				base = static_cast<uint8_t*>(mapping);
+				huge = true;
+				return;
+			}
+		}
+		base = mapAligned(this->capacity, HUGE_PAGE_SIZE);
+		madvise(base, this->capacity, MADV_HUGEPAGE); // Only a hint, fails without transparent huge pages
+	}
+	if (options.prefault)
+		prefault(base, this->capacity);
+}
+
+Arena::~Arena() {
+	if (base != nullptr)
+		munmap(base, capacity);
+}
+
+size_t Arena::footprint(size_t bytes) {
+	return roundUp(bytes, ALIGNMENT);
+}
+
+void* Arena::allocate(size_t bytes) {
+	size_t length = footprint(bytes);
+	if (base == nullptr || length > capacity - used)
+		return ::operator new(bytes);
+	void* pointer = base + used;
+	used += length;
+	return pointer;
+}
+
+void Arena::deallocate(void* pointer, size_t bytes) {
+	uint8_t* address = static_cast<uint8_t*>(pointer);
+	if (base == nullptr || address < base || address >= base + capacity) {
+		::operator delete(pointer);
+		return;
+	}
+	if (address + footprint(bytes) == base + used)
+		used -= footprint(bytes);
+}
+
+size_t Arena::size() const {
+	return capacity;
+}
+
+bool Arena::hugePages() const {
+	return huge;
+}
@@ -0,0 +1,82 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// How the pages of an arena are backed, huge pages cut the TLB misses of the large solver state
+// ADVISE asks for transparent huge pages with madvise, EXPLICIT maps from the reserved pool with MAP_HUGETLB and
+// falls back to ADVISE when the pool can't hold the arena
+enum class HugePages { NONE, ADVISE, EXPLICIT };
+
+HugePages ParseHugePages(const string& name);
+
+struct ArenaOptions {
+	HugePages huge_pages = HugePages::NONE;
+	bool prefault = false; // Touches every page when the arena is mapped rather than on the first writes
+};
+
+// One mapping holding the wave, probabilities and supports of a solver, kept for all its executions
+// Allocations are bumped from the start and only the last one is given back, what doesn't fit is allocated
+// on the heap
+class Arena {
+private:
+	uint8_t* base;
+	size_t capacity;
+	size_t used;
+	bool huge; // Mapped from the huge page pool
+public:
+	static const size_t ALIGNMENT = 64;
+	Arena(size_t capacity, const ArenaOptions& options);
+	~Arena();
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	void* allocate(size_t bytes);
+	void deallocate(void* pointer, size_t bytes);
+	size_t size() const; // Bytes mapped
+	bool hugePages() const;
+	static size_t footprint(size_t bytes); // Arena bytes taken by an allocation
+};
+
+// Allocates from an arena, or the heap without one, so containers of solver state can live in the arena
+template <typename T>
+class ArenaAllocator {
+private:
+	template <typename U>
+	friend class ArenaAllocator;
+	Arena* arena;
+public:
+	typedef T value_type;
+	ArenaAllocator(Arena* arena = nullptr) : arena(arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+	T* allocate(size_t count) {
+		if (arena == nullptr)
+			return allocator<T>().allocate(count);
+		return static_cast<T*>(arena->allocate(count * sizeof(T)));
+	}
+	void deallocate(T* pointer, size_t count) {
+		if (arena == nullptr)
+			allocator<T>().deallocate(pointer, count);
+		else
+			arena->deallocate(pointer, count * sizeof(T));
+	}
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const {
+		return arena == other.arena;
+	}
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const {
+		return arena != other.arena;
+	}
+};
+
+template <typename T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
+
+#endif
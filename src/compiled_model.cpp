@@ -0,0 +1,436 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <math.h>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "compiled_model.h"
+
+namespace fs = filesystem;
+
+// Bump when the layout changes, files are native endian and not meant to be shared between machines
+static const uint32_t FORMAT_VERSION = 4;
+static const char FORMAT_MAGIC[4] = {'W', 'F', 'C', 'M'};
+static const uint32_t NO_GROUND = UINT32_MAX;
+
+// Followed by weights, plogp, orientations, propagator offsets and neighbors (CSR),
+// palette, tile pixels, indexed pattern pixels and the tile names, each followed by a NUL
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t pattern_count;
+	uint32_t tile_count;
+	uint32_t image_count;
+	uint32_t image_height;
+	uint32_t image_width;
+	uint32_t palette_size;
+	uint32_t indexed_count;
+	uint32_t indexed_height;
+	uint32_t indexed_width;
+	uint32_t ground;
+	uint32_t directions;
+	uint32_t names_size; // Bytes
+	uint32_t entropy;
+	uint32_t reserved;
+	uint64_t neighbor_count;
+};
+
+static vector<double> normalize(const vector<double>& distribution) {
+	double sum_weights = 0.0;
+	for (uint32_t i = 0; i < distribution.size(); i++)
+		sum_weights += distribution[i];
+
+	if (sum_weights == 0)
+		throw runtime_error("Can't normalize vector of all zeroes");
+
+	double inv_sum_weights = 1.0 / sum_weights;
+	vector<double> normalized(distribution.size());
+	for (uint32_t i = 0; i < distribution.size(); i++)
+		normalized[i] = distribution[i] * inv_sum_weights;
+	return normalized;
+}
+
+static vector<double> calculate_plogp(const vector<double>& distribution) {
+	vector<double> plogp;
+	for (uint32_t i = 0; i < distribution.size(); i++) {
+		double p = distribution[i];
+		plogp.push_back(p * log(p));
+	}
+	return plogp;
+}
+
+CompiledModel::CompiledModel(const vector<Image>& images, const PropagatorState& propagator)
+	: images(images), propagator(propagator), ground(nullopt), entropy(EntropyMode::DOUBLE) {}
+
+CompiledModel::CompiledModel(const Palette& palette, const vector<IndexedImage>& patterns,
+							 const PropagatorState& propagator)
+	: palette(palette), patterns(patterns), propagator(propagator), ground(nullopt), entropy(EntropyMode::DOUBLE) {}
+
+uint32_t CompiledModel::size() const {
+	return propagator.getSize(1);
+}
+
+Palette CompiledModel::colors() const {
+	if (!patterns.empty())
+		return palette;
+	Palette colors;
+	for (vector<Image>::const_iterator it = images.begin(); it != images.end(); it++)
+		for (size_t k = 0; k < it->getHeight() * it->getWidth(); k++)
+			colors.add(it->rawData()[k]);
+	return colors;
+}
+
+void CompiledModel::setWeights(const vector<double>& weights) {
+	this->weights = normalize(weights);
+	plogp = calculate_plogp(this->weights);
+}
+
+ModelKey::ModelKey() : hash(0xCBF29CE484222325ULL) {}
+
+void ModelKey::add(const void* data, size_t size) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ULL;
+	}
+}
+
+void ModelKey::add(const string& value) {
+	add(value.c_str(), value.size() + 1);
+}
+
+void ModelKey::add(uint32_t value) {
+	add(&value, sizeof(value));
+}
+
+// FNV-1a of the contents, remembered until the file is modified so that cached models are looked up
+// without reading their sources again
+static uint64_t fileDigest(const string& path) {
+	struct FileDigest {
+		struct timespec modified;
+		off_t size;
+		uint64_t digest;
+	};
+	static mutex digests_mutex;
+	static unordered_map<string, FileDigest> digests;
+
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		throw runtime_error("Failed to read file: " + path);
+	{
+		lock_guard<mutex> lock(digests_mutex);
+		unordered_map<string, FileDigest>::const_iterator it = digests.find(path);
+		if (it != digests.end() && it->second.size == info.st_size &&
+			it->second.modified.tv_sec == info.st_mtim.tv_sec && it->second.modified.tv_nsec == info.st_mtim.tv_nsec)
+			return it->second.digest;
+	}
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		throw runtime_error("Failed to read file: " + path);
+	ModelKey contents;
+	uint8_t buffer[1 << 16];
+	size_t count;
+	while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		contents.add(buffer, count);
+	fclose(file);
+
+	lock_guard<mutex> lock(digests_mutex);
+	digests[path] = {info.st_mtim, info.st_size, contents.value()};
+	return contents.value();
+}
+
+void ModelKey::addFile(const string& path) {
+	uint64_t digest = fileDigest(path);
+	add(&digest, sizeof(digest));
+}
+
+void ModelKey::addDirectory(const string& path) {
+	vector<string> files;
+	for (const fs::directory_entry& entry : fs::directory_iterator(path))
+		if (entry.is_regular_file())
+			files.push_back(entry.path().filename().string());
+	sort(files.begin(), files.end());
+	for (vector<string>::const_iterator it = files.begin(); it != files.end(); it++) {
+		add(*it);
+		addFile(path + "/" + *it);
+	}
+}
+
+uint64_t ModelKey::value() const {
+	return hash;
+}
+
+string CompiledModelPath(const string& directory, const string& name, uint64_t key) {
+	char hex[17];
+	snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+	return directory + "/" + name + "_" + hex + ".wfcm";
+}
+
+// Bounds checked cursor over the mapped file
+class FileReader {
+private:
+	const uint8_t* data;
+	size_t remaining;
+public:
+	FileReader(const uint8_t* data, size_t size) : data(data), remaining(size) {}
+	// Whether count elements of size bytes are left, without overflowing
+	bool fits(size_t count, size_t size) const {
+		return size == 0 || count <= remaining / size;
+	}
+	template <typename T>
+	bool read(T* output, size_t count) {
+		if (!fits(count, sizeof(T)))
+			return false;
+		size_t size = count * sizeof(T);
+		if (size > 0)
+			memcpy(static_cast<void*>(output), data, size);
+		data += size;
+		remaining -= size;
+		return true;
+	}
+	// Allocates the section only once the file is known to hold it
+	template <typename T>
+	bool read(vector<T>& output, size_t count) {
+		if (!fits(count, sizeof(T)))
+			return false;
+		output.resize(count);
+		return read(output.data(), count);
+	}
+	bool finished() const {
+		return remaining == 0;
+	}
+};
+
+// Sizes in the header are checked against the rest of the file before anything is allocated for them and
+// indices are range checked, a damaged or foreign file is rejected rather than read out of bounds
+static optional<CompiledModel> readModel(const uint8_t* data, size_t size, uint64_t key) {
+	FileReader reader(data, size);
+	FileHeader header;
+	if (!reader.read(&header, 1))
+		return nullopt;
+	if (memcmp(header.magic, FORMAT_MAGIC, sizeof(FORMAT_MAGIC)) != 0 || header.version != FORMAT_VERSION ||
+		header.key != key)
+		return nullopt;
+	uint32_t directions = header.directions;
+	if (directions == 0 || header.entropy > static_cast<uint32_t>(EntropyMode::FIXED))
+		return nullopt;
+
+	uint32_t patterns = header.pattern_count;
+	if (header.image_count != 0 && header.image_count != patterns)
+		return nullopt;
+	if (header.indexed_count != 0 && header.indexed_count != patterns)
+		return nullopt;
+	if (header.ground != NO_GROUND && header.ground >= patterns)
+		return nullopt;
+	vector<double> weights;
+	vector<double> plogp;
+	vector<uint32_t> orientations;
+	vector<uint32_t> offsets;
+	vector<uint32_t> neighbors;
+	if (!reader.read(weights, patterns) || !reader.read(plogp, patterns) ||
+		!reader.read(orientations, header.tile_count) ||
+		!reader.read(offsets, static_cast<size_t>(directions) * patterns + 1) ||
+		!reader.read(neighbors, header.neighbor_count))
+		return nullopt;
+	uint64_t oriented = 0;
+	for (uint32_t t = 0; t < orientations.size(); t++)
+		oriented += orientations[t];
+	if (oriented > patterns)
+		return nullopt;
+	for (size_t i = 0; i < neighbors.size(); i++)
+		if (neighbors[i] >= patterns)
+			return nullopt;
+
+	vector<RGB> colors;
+	if (!reader.read(colors, header.palette_size))
+		return nullopt;
+	Palette palette;
+	for (uint32_t i = 0; i < colors.size(); i++)
+		if (palette.add(colors[i]) != i)
+			return nullopt;
+
+	vector<Image> images;
+	size_t image_pixels = static_cast<size_t>(header.image_height) * header.image_width;
+	if (header.image_count != 0) {
+		if (!reader.fits(image_pixels, sizeof(RGB)) || !reader.fits(header.image_count, image_pixels * sizeof(RGB)))
+			return nullopt;
+		images.assign(header.image_count, Image(header.image_height, header.image_width));
+	}
+	for (uint32_t p = 0; p < images.size(); p++)
+		if (!reader.read(images[p].rawData(), image_pixels))
+			return nullopt;
+	vector<IndexedImage> indexed;
+	if (header.indexed_count != 0) {
+		if (palette.size() > 65536)
+			return nullopt;
+		size_t indexed_pixels = static_cast<size_t>(header.indexed_height) * header.indexed_width;
+		size_t index_size = palette.size() <= 256 ? 1 : 2;
+		if (!reader.fits(indexed_pixels, index_size) || !reader.fits(header.indexed_count, indexed_pixels * index_size))
+			return nullopt;
+		indexed.assign(header.indexed_count, IndexedImage(header.indexed_height, header.indexed_width, palette));
+	}
+	for (uint32_t p = 0; p < indexed.size(); p++) {
+		if (!reader.read(indexed[p].rawData(), indexed[p].rawSize()))
+			return nullopt;
+		// Colors are looked up in the palette unchecked
+		for (size_t i = 0; i < indexed[p].getHeight(); i++)
+			for (size_t j = 0; j < indexed[p].getWidth(); j++)
+				if (indexed[p].get(i, j) >= palette.size())
+					return nullopt;
+	}
+	vector<char> names_data;
+	if (!reader.read(names_data, header.names_size) || (!names_data.empty() && names_data.back() != '\0'))
+		return nullopt;
+	vector<string> names;
+	for (size_t start = 0; start < names_data.size(); start += names.back().size() + 1)
+		names.push_back(string(names_data.data() + start));
+	if (!names.empty() && names.size() != header.tile_count)
+		return nullopt;
+	if (!reader.finished() || offsets.back() != neighbors.size())
+		return nullopt;
+
+	PropagatorState propagator(directions, patterns);
+	for (uint32_t dir = 0; dir < directions; dir++)
+		for (uint32_t p = 0; p < patterns; p++) {
+			uint32_t begin = offsets[dir * patterns + p];
+			uint32_t end = offsets[dir * patterns + p + 1];
+			if (begin > end || end > neighbors.size())
+				return nullopt;
+			propagator(dir, p).assign(neighbors.begin() + begin, neighbors.begin() + end);
+		}
+
+	CompiledModel model(images, propagator);
+	model.palette = palette;
+	model.patterns = indexed;
+	model.orientations = orientations;
+	model.names = names;
+	model.weights = weights;
+	model.plogp = plogp;
+	if (header.ground != NO_GROUND)
+		model.ground = header.ground;
+	model.entropy = static_cast<EntropyMode>(header.entropy);
+	return model;
+}
+
+optional<CompiledModel> LoadCompiledModel(const string& path, uint64_t key) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullopt;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		return nullopt;
+	}
+	void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return nullopt;
+	optional<CompiledModel> model = readModel(static_cast<const uint8_t*>(mapping), info.st_size, key);
+	munmap(mapping, info.st_size);
+	return model;
+}
+
+template <typename T>
+static void write(FILE* file, const T* data, size_t count) {
+	if (count > 0 && fwrite(data, sizeof(T), count, file) != count)
+		throw runtime_error("Failed to write compiled model");
+}
+
+template <typename T>
+static void checkSameSize(const vector<T>& images, uint32_t& height, uint32_t& width) {
+	height = images.empty() ? 0 : images[0].getHeight();
+	width = images.empty() ? 0 : images[0].getWidth();
+	for (uint32_t p = 0; p < images.size(); p++)
+		if (images[p].getHeight() != height || images[p].getWidth() != width)
+			throw logic_error("Compiled model images must have the same size");
+}
+
+void SaveCompiledModel(const string& path, uint64_t key, const CompiledModel& model) {
+	uint32_t patterns = model.size();
+	uint32_t image_height, image_width, indexed_height, indexed_width;
+	checkSameSize(model.images, image_height, image_width);
+	checkSameSize(model.patterns, indexed_height, indexed_width);
+
+	vector<uint32_t> offsets;
+	vector<uint32_t> neighbors;
+	uint32_t directions = model.propagator.getSize(0);
+	offsets.reserve(directions * patterns + 1);
+	for (uint32_t dir = 0; dir < directions; dir++)
+		for (uint32_t p = 0; p < patterns; p++) {
+			offsets.push_back(neighbors.size());
+			const vector<uint32_t>& list = model.propagator(dir, p);
+			neighbors.insert(neighbors.end(), list.begin(), list.end());
+		}
+	offsets.push_back(neighbors.size());
+
+	if (!model.names.empty() && model.names.size() != model.orientations.size())
+		throw logic_error("Compiled model tile names don't match its tiles");
+	string names;
+	for (vector<string>::const_iterator it = model.names.begin(); it != model.names.end(); it++) {
+		if (it->find('\0') != string::npos)
+			throw invalid_argument("Tile name contains a NUL");
+		names += *it;
+		names.push_back('\0');
+	}
+
+	FileHeader header;
+	memcpy(header.magic, FORMAT_MAGIC, sizeof(FORMAT_MAGIC));
+	header.version = FORMAT_VERSION;
+	header.key = key;
+	header.pattern_count = patterns;
+	header.tile_count = model.orientations.size();
+	header.image_count = model.images.size();
+	header.image_height = image_height;
+	header.image_width = image_width;
+	header.palette_size = model.palette.size();
+	header.indexed_count = model.patterns.size();
+	header.indexed_height = indexed_height;
+	header.indexed_width = indexed_width;
+	header.ground = model.ground.value_or(NO_GROUND);
+	header.directions = directions;
+	header.names_size = names.size();
+	header.entropy = static_cast<uint32_t>(model.entropy);
+	header.reserved = 0;
+	header.neighbor_count = neighbors.size();
+
+	// Written next to the destination and renamed, concurrent runs and threads never see a partial file
+	string temporary_path =
+		path + "." + to_string(getpid()) + "." + to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+	FILE* file = fopen(temporary_path.c_str(), "wb");
+	if (file == nullptr)
+		throw runtime_error("Failed to create compiled model: " + temporary_path);
+	try {
+		write(file, &header, 1);
+		write(file, model.weights.data(), model.weights.size());
+		write(file, model.plogp.data(), model.plogp.size());
+		write(file, model.orientations.data(), model.orientations.size());
+		write(file, offsets.data(), offsets.size());
+		write(file, neighbors.data(), neighbors.size());
+		for (uint32_t i = 0; i < model.palette.size(); i++)
+			write(file, &model.palette[i], 1);
+		for (uint32_t p = 0; p < model.images.size(); p++)
+			write(file, model.images[p].rawData(), image_height * image_width);
+		for (uint32_t p = 0; p < model.patterns.size(); p++)
+			write(file, model.patterns[p].rawData(), model.patterns[p].rawSize());
+		write(file, names.data(), names.size());
+	} catch (...) {
+		fclose(file);
+		remove(temporary_path.c_str());
+		throw;
+	}
+	// Buffered data is only flushed by fclose, a failure there would leave a truncated model
+	if (fclose(file) != 0 || rename(temporary_path.c_str(), path.c_str()) != 0) {
+		remove(temporary_path.c_str());
+		throw runtime_error("Failed to save compiled model: " + path);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef COMPILED_MODEL_H
+#define COMPILED_MODEL_H
+
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "propagator.h"
+#include "wave.h"
+
+using namespace std;
+
+// Everything needed to start solving a model, independent of the output size
+struct CompiledModel {
+	vector<Image> images;          // Pixels of every tile pattern, all the same size
+	Palette palette;               // Colors of the overlapping patterns
+	vector<IndexedImage> patterns; // Overlapping patterns, all the same size
+	vector<uint32_t> orientations; // Number of consecutive patterns of each tile
+	vector<string> names;          // Of the tiles when they have one, in the same order
+	vector<double> weights;        // Normalized
+	vector<double> plogp;
+	PropagatorState propagator;
+	optional<uint32_t> ground;
+	EntropyMode entropy; // Arithmetic of the solvers
+	CompiledModel(const vector<Image>& images, const PropagatorState& propagator);
+	CompiledModel(const Palette& palette, const vector<IndexedImage>& patterns, const PropagatorState& propagator);
+	uint32_t size() const;
+	Palette colors() const; // Every color an output can contain
+	void setWeights(const vector<double>& weights);
+};
+
+// 64-bit FNV-1a of everything a compiled model is built from
+class ModelKey {
+private:
+	uint64_t hash;
+public:
+	ModelKey();
+	void add(const void* data, size_t size);
+	void add(const string& value);
+	void add(uint32_t value);
+	void addFile(const string& path);
+	void addDirectory(const string& path);
+	uint64_t value() const;
+};
+
+string CompiledModelPath(const string& directory, const string& name, uint64_t key);
+// Returns nullopt if the file is missing, from another version or built from other sources
+optional<CompiledModel> LoadCompiledModel(const string& path, uint64_t key);
+void SaveCompiledModel(const string& path, uint64_t key, const CompiledModel& model);
+
+#endif
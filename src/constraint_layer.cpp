@@ -0,0 +1,135 @@
+#include <fstream>
+#include <stdexcept>
+#include <string.h>
+#include <strings.h>
+#include <unordered_map>
+
+#include "constraint_layer.h"
+#include "image.h"
+#include "image_cache.h"
+
+static string trim(const string& value) {
+	size_t begin = value.find_first_not_of(" \t\r");
+	if (begin == string::npos)
+		return "";
+	return value.substr(begin, value.find_last_not_of(" \t\r") - begin + 1);
+}
+
+// Patterns of every tile are consecutive, in the order of the model's names
+static vector<uint8_t> compileRule(const ConstraintRule& rule, const CompiledModel& model,
+								   const unordered_map<string, uint32_t>& tile_indices,
+								   const vector<uint32_t>& first_patterns) {
+	vector<uint8_t> allowed(model.size(), rule.exclude);
+	for (vector<string>::const_iterator it = rule.tiles.begin(); it != rule.tiles.end(); it++) {
+		string name = trim(*it);
+		unordered_map<string, uint32_t>::const_iterator tile = tile_indices.find(name);
+		uint32_t first = 0;
+		uint32_t count = 0;
+		if (tile != tile_indices.end()) {
+			first = first_patterns[tile->second];
+			count = model.orientations[tile->second];
+		} else {
+			size_t delim = name.rfind(' ');
+			string orientation_name = delim == string::npos ? "" : name.substr(delim + 1);
+			if (!orientation_name.empty() && orientation_name.find_first_not_of("0123456789") == string::npos)
+				tile = tile_indices.find(trim(name.substr(0, delim)));
+			if (tile == tile_indices.end())
+				throw invalid_argument("Unknown tile in constraint rule: " + name);
+			uint32_t orientation = stoul(orientation_name);
+			if (orientation >= model.orientations[tile->second])
+				throw out_of_range("Orientation out of range in constraint rule: " + name);
+			first = first_patterns[tile->second] + orientation;
+			count = 1;
+		}
+		for (uint32_t p = first; p < first + count; p++)
+			allowed[p] = !rule.exclude;
+	}
+	return allowed;
+}
+
+static RGB parseColor(const string& label) {
+	string hex = label.size() > 0 && label[0] == '#' ? label.substr(1) : label;
+	if (hex.size() != 6 || hex.find_first_not_of("0123456789abcdefABCDEF") != string::npos)
+		throw invalid_argument("Constraint color is not RRGGBB: " + label);
+	uint32_t value = stoul(hex, nullptr, 16);
+	return {static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+}
+
+// Index of the rule of every cell, rules.size() for the unconstrained ones
+static vector<uint32_t> readImageLabels(const string& path, vec2 size, const vector<ConstraintRule>& rules) {
+	unordered_map<RGB, uint32_t, RGBHash> rule_indices;
+	for (uint32_t r = 0; r < rules.size(); r++)
+		rule_indices.insert({parseColor(rules[r].label), r});
+	Image image = ImageCache::global().load(path);
+	if (image.getHeight() != size.height() || image.getWidth() != size.width())
+		throw invalid_argument("Constraint layer " + path + " is not the size of the output");
+	vector<uint32_t> labels(image.getHeight() * image.getWidth());
+	const RGB* pixels = image.rawData();
+	for (size_t cell = 0; cell < labels.size(); cell++) {
+		unordered_map<RGB, uint32_t, RGBHash>::const_iterator it = rule_indices.find(pixels[cell]);
+		labels[cell] = it == rule_indices.end() ? rules.size() : it->second;
+	}
+	return labels;
+}
+
+static vector<uint32_t> readCSVLabels(const string& path, vec2 size, const vector<ConstraintRule>& rules) {
+	unordered_map<string, uint32_t> rule_indices;
+	for (uint32_t r = 0; r < rules.size(); r++)
+		rule_indices.insert({trim(rules[r].label), r});
+	ifstream file(path);
+	if (!file)
+		throw runtime_error("Failed to read constraint layer: " + path);
+	vector<uint32_t> labels;
+	labels.reserve(size.height() * size.width());
+	string line;
+	uint32_t rows = 0;
+	while (getline(file, line)) {
+		if (trim(line).empty())
+			continue;
+		uint32_t columns = 0;
+		size_t begin = 0;
+		while (true) {
+			size_t end = line.find(',', begin);
+			string field = trim(line.substr(begin, end == string::npos ? string::npos : end - begin));
+			unordered_map<string, uint32_t>::const_iterator it = rule_indices.find(field);
+			labels.push_back(field.empty() || it == rule_indices.end() ? rules.size() : it->second);
+			columns++;
+			if (end == string::npos)
+				break;
+			begin = end + 1;
+		}
+		if (columns != size.width())
+			throw invalid_argument("Constraint layer " + path + " is not the size of the output");
+		rows++;
+	}
+	if (rows != size.height())
+		throw invalid_argument("Constraint layer " + path + " is not the size of the output");
+	return labels;
+}
+
+Array2D<uint8_t> CompileConstraintLayer(const string& path, vec2 size, const vector<ConstraintRule>& rules,
+										const CompiledModel& model) {
+	if (model.names.empty() || model.names.size() != model.orientations.size())
+		throw invalid_argument("Constraint layers need a model with named tiles");
+	unordered_map<string, uint32_t> tile_indices;
+	vector<uint32_t> first_patterns;
+	uint32_t first = 0;
+	for (uint32_t t = 0; t < model.names.size(); t++) {
+		tile_indices.insert({model.names[t], t});
+		first_patterns.push_back(first);
+		first += model.orientations[t];
+	}
+
+	// The last mask is for the cells without a rule
+	vector<vector<uint8_t>> masks;
+	for (vector<ConstraintRule>::const_iterator it = rules.begin(); it != rules.end(); it++)
+		masks.push_back(compileRule(*it, model, tile_indices, first_patterns));
+	masks.push_back(vector<uint8_t>(model.size(), true));
+
+	bool csv = path.size() >= 4 && strcasecmp(path.c_str() + path.size() - 4, ".csv") == 0;
+	vector<uint32_t> labels = csv ? readCSVLabels(path, size, rules) : readImageLabels(path, size, rules);
+	Array2D<uint8_t> allowed(labels.size(), model.size());
+	for (uint32_t cell = 0; cell < labels.size(); cell++)
+		memcpy(&allowed(cell, 0), masks[labels[cell]].data(), model.size());
+	return allowed;
+}
@@ -0,0 +1,25 @@
+#ifndef CONSTRAINT_LAYER_H
+#define CONSTRAINT_LAYER_H
+
+#include <string>
+#include <vector>
+
+#include "compiled_model.h"
+#include "multi_array.h"
+
+using namespace std;
+
+// Tiles allowed in the cells painted with a label
+struct ConstraintRule {
+	string label;         // RRGGBB color for image layers, field value for CSV layers
+	vector<string> tiles; // "name" for every orientation of a tile or "name orientation" for one
+	bool exclude;         // Allows every tile but these
+};
+
+// A layer gives every output cell a label, the pixel of an image of the output size in tiles or the field
+// of a CSV file with a comma separated line per row
+// It is compiled into a mask per cell of the patterns allowed, cells whose label has no rule allow every pattern
+Array2D<uint8_t> CompileConstraintLayer(const string& path, vec2 size, const vector<ConstraintRule>& rules,
+										const CompiledModel& model);
+
+#endif
@@ -0,0 +1,348 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+
+// Answers a request the handler threw on with an error in the syntax of the request, like the handler would
+static string ErrorResponse(const string& request, const string& error) {
+	if (request[request.find_first_not_of(" \t")] != '<')
+		return "{\"status\":\"error\",\"error\":" + JSONString(error) + "}";
+	string escaped;
+	for (size_t i = 0; i < error.size(); i++) {
+		if (error[i] == '&')
+			escaped += "&amp;";
+		else if (error[i] == '<')
+			escaped += "&lt;";
+		else if (error[i] == '>')
+			escaped += "&gt;";
+		else if (error[i] == '"')
+			escaped += "&quot;";
+		else
+			escaped += error[i];
+	}
+	return "<result id=\"\" status=\"error\" error=\"" + escaped + "\"/>";
+}
+
+void Daemon::work() {
+	while (true) {
+		unique_lock<mutex> lock(queue_mutex);
+		not_empty.wait(lock, [this] { return stopping || !requests.empty(); });
+		if (requests.empty())
+			return;
+		Request request = move(requests.front());
+		requests.pop_front();
+		lock.unlock();
+
+		string response;
+		try {
+			response = handler(request.line);
+		} catch (const exception& e) {
+			response = ErrorResponse(request.line, e.what());
+		}
+		answer(*request.connection, response);
+
+		lock.lock();
+		request.connection->pending--;
+		lock.unlock();
+		answered.notify_all();
+	}
+}
+
+void Daemon::answer(Connection& connection, const string& line) {
+	string data = line + "\n";
+	lock_guard<mutex> lock(connection.output_mutex);
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t count = ::write(connection.output, data.data() + written, data.size() - written);
+		if (count < 0 && errno == EINTR)
+			continue;
+		// The client went away, its remaining answers are dropped
+		if (count <= 0)
+			return;
+		written += count;
+	}
+}
+
+void Daemon::submit(const shared_ptr<Connection>& connection, string line) {
+	if (!line.empty() && line.back() == '\r')
+		line.pop_back();
+	if (line.find_first_not_of(" \t") == string::npos)
+		return;
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		connection->pending++;
+		requests.push_back({connection, move(line)});
+	}
+	not_empty.notify_one();
+}
+
+void Daemon::receive(int input, const shared_ptr<Connection>& connection) {
+	string buffer;
+	char chunk[1 << 16];
+	while (true) {
+		ssize_t count = ::read(input, chunk, sizeof(chunk));
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			break;
+		buffer.append(chunk, count);
+		size_t begin = 0;
+		size_t end;
+		while ((end = buffer.find('\n', begin)) != string::npos) {
+			submit(connection, buffer.substr(begin, end - begin));
+			begin = end + 1;
+		}
+		buffer.erase(0, begin);
+	}
+	// The last request may not end with a newline
+	submit(connection, buffer);
+
+	unique_lock<mutex> lock(queue_mutex);
+	answered.wait(lock, [&connection] { return connection->pending == 0; });
+}
+
+Daemon::Daemon(uint32_t threads, const function<string(const string&)>& handler) : handler(handler), stopping(false) {
+	for (uint32_t i = 0; i < max(1u, threads); i++)
+		workers.emplace_back(&Daemon::work, this);
+}
+
+Daemon::~Daemon() {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	// Workers answer the queued requests before exiting
+	not_empty.notify_all();
+	for (vector<thread>::iterator it = workers.begin(); it != workers.end(); it++)
+		it->join();
+}
+
+void Daemon::serve(int input, int output) {
+	shared_ptr<Connection> connection = make_shared<Connection>();
+	connection->output = output;
+	receive(input, connection);
+}
+
+void Daemon::listen(const string& socket_path) {
+	// Clients may disconnect before they are answered
+	signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path))
+		throw invalid_argument("Socket path is too long: " + socket_path);
+	strcpy(address.sun_path, socket_path.c_str());
+
+	// A socket left by a previous daemon is replaced, any other file is kept
+	struct stat info;
+	if (lstat(socket_path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+		unlink(socket_path.c_str());
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0)
+		throw runtime_error("Failed to create socket");
+	if (bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(server, SOMAXCONN) != 0) {
+		close(server);
+		throw runtime_error("Failed to listen on " + socket_path);
+	}
+	while (true) {
+		int client = accept(server, nullptr, nullptr);
+		if (client < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			close(server);
+			throw runtime_error("Failed to accept a client on " + socket_path);
+		}
+		thread([this, client]() {
+			shared_ptr<Connection> connection = make_shared<Connection>();
+			connection->output = client;
+			receive(client, connection);
+			close(client);
+		}).detach();
+	}
+}
+
+static void skipSpaces(const string& text, size_t& pos) {
+	while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n'))
+		pos++;
+}
+
+static void appendUTF8(string& output, uint32_t code) {
+	if (code < 0x80)
+		output += static_cast<char>(code);
+	else if (code < 0x800) {
+		output += static_cast<char>(0xC0 | code >> 6);
+		output += static_cast<char>(0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		output += static_cast<char>(0xE0 | code >> 12);
+		output += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+		output += static_cast<char>(0x80 | (code & 0x3F));
+	} else {
+		output += static_cast<char>(0xF0 | code >> 18);
+		output += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+		output += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+		output += static_cast<char>(0x80 | (code & 0x3F));
+	}
+}
+
+static uint32_t parseHex4(const string& text, size_t& pos) {
+	if (pos + 4 > text.size())
+		throw invalid_argument("Malformed JSON escape");
+	uint32_t code = 0;
+	for (uint32_t k = 0; k < 4; k++) {
+		char c = text[pos++];
+		code <<= 4;
+		if (c >= '0' && c <= '9')
+			code |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			code |= c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			code |= c - 'A' + 10;
+		else
+			throw invalid_argument("Malformed JSON escape");
+	}
+	return code;
+}
+
+// pos is on the opening quote, and after the closing one on return
+static string parseString(const string& text, size_t& pos) {
+	string value;
+	pos++;
+	while (pos < text.size() && text[pos] != '"') {
+		char c = text[pos++];
+		if (c != '\\') {
+			value += c;
+			continue;
+		}
+		if (pos == text.size())
+			break;
+		c = text[pos++];
+		switch (c) {
+		case 'b': value += '\b'; break;
+		case 'f': value += '\f'; break;
+		case 'n': value += '\n'; break;
+		case 'r': value += '\r'; break;
+		case 't': value += '\t'; break;
+		case 'u': {
+			uint32_t code = parseHex4(text, pos);
+			// Characters outside the BMP are written as a surrogate pair
+			if (code >= 0xD800 && code < 0xDC00 && text.compare(pos, 2, "\\u") == 0) {
+				pos += 2;
+				uint32_t low = parseHex4(text, pos);
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			}
+			appendUTF8(value, code);
+			break;
+		}
+		default: value += c; break;
+		}
+	}
+	if (pos == text.size())
+		throw invalid_argument("Unterminated JSON string");
+	pos++;
+	return value;
+}
+
+vector<pair<string, string>> ParseJSONObject(const string& text) {
+	vector<pair<string, string>> members;
+	size_t pos = 0;
+	skipSpaces(text, pos);
+	if (pos == text.size() || text[pos] != '{')
+		throw invalid_argument("Expected a JSON object");
+	pos++;
+	skipSpaces(text, pos);
+	if (pos < text.size() && text[pos] == '}')
+		pos++;
+	else
+		while (true) {
+			skipSpaces(text, pos);
+			if (pos == text.size() || text[pos] != '"')
+				throw invalid_argument("Expected a JSON key");
+			string key = parseString(text, pos);
+			skipSpaces(text, pos);
+			if (pos == text.size() || text[pos] != ':')
+				throw invalid_argument("Expected ':' after \"" + key + "\"");
+			pos++;
+			skipSpaces(text, pos);
+			if (pos < text.size() && text[pos] == '"')
+				members.push_back({key, parseString(text, pos)});
+			else {
+				size_t end = text.find_first_of(",} \t\r\n", pos);
+				string value = text.substr(pos, end == string::npos ? string::npos : end - pos);
+				char* number_end = nullptr;
+				strtod(value.c_str(), &number_end);
+				if (value != "true" && value != "false" && value != "null" &&
+					(value.empty() || *number_end != '\0'))
+					throw invalid_argument("Unsupported JSON value for \"" + key + "\"");
+				if (value != "null")
+					members.push_back({key, value});
+				pos += value.size();
+			}
+			skipSpaces(text, pos);
+			if (pos < text.size() && text[pos] == ',') {
+				pos++;
+				continue;
+			}
+			if (pos < text.size() && text[pos] == '}') {
+				pos++;
+				break;
+			}
+			throw invalid_argument("Expected ',' or '}' in JSON object");
+		}
+	skipSpaces(text, pos);
+	if (pos != text.size())
+		throw invalid_argument("Unexpected characters after JSON object");
+	return members;
+}
+
+string JSONString(const string& value) {
+	string output = "\"";
+	for (size_t i = 0; i < value.size(); i++) {
+		unsigned char c = value[i];
+		if (c == '"' || c == '\\') {
+			output += '\\';
+			output += c;
+		} else if (c == '\n')
+			output += "\\n";
+		else if (c == '\t')
+			output += "\\t";
+		else if (c < 0x20) {
+			char escape[7];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			output += escape;
+		} else
+			output += c;
+	}
+	return output + "\"";
+}
+
+string Base64Encode(const vector<uint8_t>& data) {
+	static const char DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string output;
+	output.reserve((data.size() + 2) / 3 * 4);
+	size_t i = 0;
+	for (; i + 2 < data.size(); i += 3) {
+		uint32_t bits = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+		output += DIGITS[bits >> 18];
+		output += DIGITS[bits >> 12 & 0x3F];
+		output += DIGITS[bits >> 6 & 0x3F];
+		output += DIGITS[bits & 0x3F];
+	}
+	if (i < data.size()) {
+		uint32_t bits = data[i] << 16 | (i + 1 < data.size() ? data[i + 1] << 8 : 0);
+		output += DIGITS[bits >> 18];
+		output += DIGITS[bits >> 12 & 0x3F];
+		output += i + 1 < data.size() ? DIGITS[bits >> 6 & 0x3F] : '=';
+		output += '=';
+	}
+	return output;
+}
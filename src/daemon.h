@@ -0,0 +1,56 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Answers newline delimited requests, each request is answered by one line in the order it finishes
+// Requests of every connection are handled by the same worker threads
+class Daemon {
+private:
+	struct Connection {
+		int output;
+		mutex output_mutex;
+		uint32_t pending = 0; // Guarded by the queue mutex
+	};
+	struct Request {
+		shared_ptr<Connection> connection;
+		string line;
+	};
+	const function<string(const string&)> handler;
+	bool stopping;
+	mutex queue_mutex;
+	condition_variable not_empty;
+	condition_variable answered;
+	deque<Request> requests;
+	vector<thread> workers;
+	void work();
+	void answer(Connection& connection, const string& line);
+	void submit(const shared_ptr<Connection>& connection, string line);
+	// Until input is closed, then waits for the answers of the connection
+	void receive(int input, const shared_ptr<Connection>& connection);
+public:
+	Daemon(uint32_t threads, const function<string(const string&)>& handler);
+	~Daemon();
+	// Reads requests from input until it's closed and waits for every answer
+	void serve(int input, int output);
+	// Accepts clients on a Unix domain socket forever, each client is read on its own thread
+	void listen(const string& socket_path);
+};
+
+// Flat object of strings, numbers, booleans and nulls, values are returned unquoted and nulls are left out
+vector<pair<string, string>> ParseJSONObject(const string& text);
+string JSONString(const string& value);
+string Base64Encode(const vector<uint8_t>& data);
+
+#endif
@@ -0,0 +1,142 @@
+#include <string.h>
+
+#include "frame_capture.h"
+
+static const int FRAME_COMPRESSION = 6;
+
+// Overlapping patterns only need their top left pixel, unless the edge is drawn from them
+static vector<Image> patternImages(const CompiledModel& model, uint32_t edge) {
+	if (model.patterns.empty())
+		return model.images;
+	vector<Image> images;
+	for (vector<IndexedImage>::const_iterator it = model.patterns.begin(); it != model.patterns.end(); it++) {
+		Image image(edge + 1, edge + 1);
+		for (uint32_t i = 0; i <= edge; i++)
+			for (uint32_t j = 0; j <= edge; j++)
+				image(i, j) = model.palette[it->get(i, j)];
+		images.push_back(image);
+	}
+	return images;
+}
+
+static RGB meanColor(const Image& image) {
+	uint64_t sums[3] = {0, 0, 0};
+	size_t count = image.getHeight() * image.getWidth();
+	for (size_t k = 0; k < count; k++) {
+		sums[0] += image.rawData()[k].r;
+		sums[1] += image.rawData()[k].g;
+		sums[2] += image.rawData()[k].b;
+	}
+	return {static_cast<uint8_t>(sums[0] / count), static_cast<uint8_t>(sums[1] / count),
+			static_cast<uint8_t>(sums[2] / count)};
+}
+
+FrameCapture::FrameCapture(vec2 size, const CompiledModel& model, uint32_t interval, uint32_t delay_ms, uint32_t edge)
+	: size(size), interval(max(1u, interval)), edge(edge), pattern_images(patternImages(model, edge)),
+	  cell_height(model.patterns.empty() ? pattern_images.at(0).getHeight() : 1),
+	  cell_width(model.patterns.empty() ? pattern_images.at(0).getWidth() : 1), cells(size.height(), size.width()),
+	  dirty(size.height(), size.width()), canvas(size.height() * cell_height + edge, size.width() * cell_width + edge),
+	  steps(0), writer(canvas.getHeight(), canvas.getWidth(), delay_ms, FRAME_COMPRESSION) {
+	initial = {0, 0, 0, 0, static_cast<uint32_t>(pattern_images.size())};
+	for (uint32_t p = 0; p < pattern_images.size(); p++) {
+		pattern_colors.push_back(meanColor(pattern_images[p].subImage(0, 0, cell_height, cell_width)));
+		initial.red += pattern_colors[p].r;
+		initial.green += pattern_colors[p].g;
+		initial.blue += pattern_colors[p].b;
+		initial.pattern_sum += p;
+	}
+}
+
+size_t FrameCapture::drawnHeight(uint32_t i) const {
+	return i + 1 == size.height() ? cell_height + edge : cell_height;
+}
+
+size_t FrameCapture::drawnWidth(uint32_t j) const {
+	return j + 1 == size.width() ? cell_width + edge : cell_width;
+}
+
+void FrameCapture::draw(vec2 index) {
+	const Cell& cell = cells(index.i, index.j);
+	size_t height = drawnHeight(index.i);
+	size_t width = drawnWidth(index.j);
+	RGB* origin = canvas.rawData() + index.i * cell_height * canvas.getWidth() + index.j * cell_width;
+	if (cell.remaining == 1) {
+		const Image& image = pattern_images[cell.pattern_sum];
+		for (size_t i = 0; i < height; i++)
+			memcpy(static_cast<void*>(origin + i * canvas.getWidth()), image.rawData() + i * image.getWidth(),
+				   width * sizeof(RGB));
+		return;
+	}
+	// Contradictions are black, undecided edge pixels take the mean color of their cell
+	RGB color = {0, 0, 0};
+	if (cell.remaining > 1)
+		color = {static_cast<uint8_t>(cell.red / cell.remaining), static_cast<uint8_t>(cell.green / cell.remaining),
+				 static_cast<uint8_t>(cell.blue / cell.remaining)};
+	for (size_t i = 0; i < height; i++)
+		for (size_t j = 0; j < width; j++)
+			origin[i * canvas.getWidth() + j] = color;
+}
+
+vector<Removal>* FrameCapture::removalLog() {
+	return &removals;
+}
+
+void FrameCapture::reset() {
+	cells.fill(initial);
+	dirty.fill(false);
+	dirty_cells.clear();
+	removals.clear();
+	steps = 0;
+	for (uint32_t i = 0; i < size.height(); i++)
+		for (uint32_t j = 0; j < size.width(); j++)
+			draw(vec2(i, j));
+	writer.restart(Image(canvas));
+}
+
+void FrameCapture::step() {
+	steps++;
+	if (steps % interval == 0)
+		flush();
+}
+
+void FrameCapture::flush() {
+	for (vector<Removal>::const_iterator it = removals.begin(); it != removals.end(); it++) {
+		vec2 index(it->cell / size.width(), it->cell % size.width());
+		Cell& cell = cells(index.i, index.j);
+		const RGB& color = pattern_colors[it->pattern];
+		cell.red -= color.r;
+		cell.green -= color.g;
+		cell.blue -= color.b;
+		cell.pattern_sum -= it->pattern;
+		cell.remaining--;
+		if (!dirty(index.i, index.j)) {
+			dirty(index.i, index.j) = true;
+			dirty_cells.push_back(index);
+		}
+	}
+	removals.clear();
+	if (dirty_cells.empty())
+		return;
+
+	vec2 low = dirty_cells[0];
+	vec2 high = dirty_cells[0];
+	for (vector<vec2>::const_iterator it = dirty_cells.begin(); it != dirty_cells.end(); it++) {
+		draw(*it);
+		dirty(it->i, it->j) = false;
+		low = vec2(min(low.i, it->i), min(low.j, it->j));
+		high = vec2(max(high.i, it->i), max(high.j, it->j));
+	}
+	dirty_cells.clear();
+
+	Image region((high.i - low.i) * cell_height + drawnHeight(high.i),
+				 (high.j - low.j) * cell_width + drawnWidth(high.j));
+	const RGB* origin = canvas.rawData() + low.i * cell_height * canvas.getWidth() + low.j * cell_width;
+	for (size_t i = 0; i < region.getHeight(); i++)
+		memcpy(static_cast<void*>(region.rawData() + i * region.getWidth()), origin + i * canvas.getWidth(),
+			   region.getWidth() * sizeof(RGB));
+	writer.add(low.i * cell_height, low.j * cell_width, move(region));
+}
+
+void FrameCapture::save(const string& path) {
+	writer.save(path);
+}
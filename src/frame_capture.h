@@ -0,0 +1,53 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "animation_writer.h"
+#include "compiled_model.h"
+#include "image.h"
+#include "multi_array.h"
+#include "wave.h"
+
+using namespace std;
+
+// Draws the wave while it is solved, collapsed cells show their pattern and the others the mean color
+// of their remaining patterns
+// Cells are only redrawn when their domain changes, and each frame is the region that changed since the previous one
+// Non-periodic overlapping outputs are edge pixels larger than the grid, drawn from the patterns of the last cells
+class FrameCapture {
+private:
+	struct Cell {
+		uint64_t red, green, blue; // Sums of the mean colors of the remaining patterns
+		uint64_t pattern_sum;      // The remaining pattern once there is only one
+		uint32_t remaining;
+	};
+	const vec2 size;
+	const uint32_t interval;
+	const uint32_t edge;
+	vector<Image> pattern_images; // All the same size, drawn from their top left corner
+	size_t cell_height, cell_width; // Pixels of a cell, one for overlapping patterns
+	vector<RGB> pattern_colors;
+	Cell initial;
+	Array2D<Cell> cells;
+	Array2D<uint8_t> dirty;
+	vector<vec2> dirty_cells;
+	vector<Removal> removals;
+	Image canvas;
+	uint32_t steps;
+	AnimationWriter writer;
+	void draw(vec2 index);
+	size_t drawnHeight(uint32_t i) const; // Pixels drawn by the cells of a row, with the edge below the last one
+	size_t drawnWidth(uint32_t j) const;
+public:
+	FrameCapture(vec2 size, const CompiledModel& model, uint32_t interval, uint32_t delay_ms, uint32_t edge = 0);
+	vector<Removal>* removalLog(); // Filled by the wave
+	void reset();                  // The wave was reset, restarts the animation
+	void step();                   // After each observation, emits a frame every interval steps
+	void flush();                  // Emits the changes since the last frame
+	void save(const string& path);
+};
+
+#endif
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <stdexcept>
+#include <string.h>
 
 #include "image.h"
 
@@ -15,8 +17,15 @@ bool RGB::operator!=(const RGB& c) const {
 	return !(c == *this);
 }
 
+static_assert(sizeof(RGB) == 3, "Images are handed to the codecs as packed RGB bytes");
+
 Image::Image(size_t height, size_t width) : Array2D<RGB>(height, width) {}
 
+Image::Image(size_t height, size_t width, const RGB* pixels) : Array2D<RGB>(0, 0) {
+	size = {height, width};
+	data.assign(pixels, pixels + height * width);
+}
+
 size_t Image::height() const {
 	return size[0];
 }
@@ -33,27 +42,43 @@ size_t Image::getWidth() const {
 	return width();
 }
 
+RGB* Image::rawData() {
+	return data.data();
+}
+
 const RGB* Image::rawData() const {
 	return data.data();
 }
 
+// The transforms work on raw rows without bounds checks
+// Rotation gathers a source column per result row, blocking it measured no faster for tiles up to 128 pixels
+// wide since both images stay in the L1 cache
 Image Image::rotate() const {
 	if (height() != width())
 		throw logic_error("Image to rotate is not square");
-	Image result(height(), width());
-	for (size_t i = 0; i < height(); i++)
-		for (size_t j = 0; j < width(); j++)
-			result(j, i) = (*this)(i, width() - 1 - j);
+	size_t n = width();
+	Image result(n, n);
+	const RGB* src = rawData();
+	RGB* dst = result.rawData();
+	// Row j of the result is column n - 1 - j of the source read top to bottom
+	for (size_t j = 0; j < n; j++) {
+		const RGB* column = src + n - 1 - j;
+		RGB* row = dst + j * n;
+		for (size_t i = 0; i < n; i++)
+			row[i] = column[i * n];
+	}
 	return result;
 }
 
 Image Image::mirror() const {
-	Image result(height(), width());
 	if (height() != width())
 		throw logic_error("Image to mirror is not square");
-	for (size_t i = 0; i < height(); i++)
-		for (size_t j = 0; j < width(); j++)
-			result(i, j) = (*this)(i, width() - 1 - j);
+	size_t n = width();
+	Image result(n, n);
+	const RGB* src = rawData();
+	RGB* dst = result.rawData();
+	for (size_t i = 0; i < n; i++)
+		reverse_copy(src + i * n, src + (i + 1) * n, dst + i * n);
 	return result;
 }
 
@@ -74,47 +99,546 @@ Image Image::subImage(size_t i0, size_t j0, size_t height, size_t width) const {
 bool Image::operator==(const Image& image) const {
 	if (height() != image.height() || width() != image.width())
 		return false;
-	for (size_t i = 0; i < data.size(); i++)
-		if (image.data[i] != data[i])
-			return false;
-	return true;
+	return data.empty() || memcmp(data.data(), image.data.data(), data.size() * sizeof(RGB)) == 0;
 }
 
 size_t RGBHash::operator()(const RGB& color) const {
 	return static_cast<size_t>(color.r) << 16 | static_cast<size_t>(color.g) << 8 | static_cast<size_t>(color.b);
 }
 
+// wyhash final4 by Wang Yi, public domain: github.com/wangyi-fudan/wyhash
+static const uint64_t WYHASH_SECRET[4] = {0x2D358DCCAA6C78A5ULL, 0x8BB84B93962EACC9ULL, 0x4B33A62ED433D4A3ULL,
+										  0x4D5A2DA51DE1AA47ULL};
+
+// Full 128-bit product, low half in a and high half in b
+static void WyMultiply(uint64_t& a, uint64_t& b) {
+	__uint128_t product = static_cast<__uint128_t>(a) * b;
+	a = static_cast<uint64_t>(product);
+	b = static_cast<uint64_t>(product >> 64);
+}
+
+static uint64_t WyMix(uint64_t a, uint64_t b) {
+	WyMultiply(a, b);
+	return a ^ b;
+}
+
+static uint64_t ReadWord(const uint8_t* p) {
+	uint64_t word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+static uint64_t ReadHalfWord(const uint8_t* p) {
+	uint32_t half;
+	memcpy(&half, p, sizeof(half));
+	return half;
+}
+
+static uint64_t HashBytes(const uint8_t* data, size_t length, uint64_t seed) {
+	const uint64_t* secret = WYHASH_SECRET;
+	const uint8_t* p = data;
+	seed ^= WyMix(seed ^ secret[0], secret[1]);
+	uint64_t a, b;
+	if (length <= 16) {
+		if (length >= 4) {
+			size_t middle = (length >> 3) << 2;
+			a = ReadHalfWord(p) << 32 | ReadHalfWord(p + middle);
+			b = ReadHalfWord(p + length - 4) << 32 | ReadHalfWord(p + length - 4 - middle);
+		} else if (length > 0) {
+			a = static_cast<uint64_t>(p[0]) << 16 | static_cast<uint64_t>(p[length >> 1]) << 8 | p[length - 1];
+			b = 0;
+		} else
+			a = b = 0;
+	} else {
+		size_t i = length;
+		// Three independent lanes of 16 bytes, so the multiplications pipeline
+		if (i > 48) {
+			uint64_t seed1 = seed;
+			uint64_t seed2 = seed;
+			do {
+				seed = WyMix(ReadWord(p) ^ secret[1], ReadWord(p + 8) ^ seed);
+				seed1 = WyMix(ReadWord(p + 16) ^ secret[2], ReadWord(p + 24) ^ seed1);
+				seed2 = WyMix(ReadWord(p + 32) ^ secret[3], ReadWord(p + 40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		for (; i > 16; i -= 16, p += 16)
+			seed = WyMix(ReadWord(p) ^ secret[1], ReadWord(p + 8) ^ seed);
+		a = ReadWord(p + i - 16);
+		b = ReadWord(p + i - 8);
+	}
+	a ^= secret[1];
+	b ^= seed;
+	WyMultiply(a, b);
+	return WyMix(a ^ secret[0] ^ length, b ^ secret[1]);
+}
+
 size_t ImageHash::operator()(const Image& image) const {
-	size_t hash = 0;
-	const RGB* data = image.rawData();
-	size_t length = image.getHeight() * image.getWidth();
-	for (size_t i = 0; i < length; i++) {
-		const RGB& pixel = data[i];
-		hash ^= RGBHash()(pixel) + 0x9E3779B9 + (hash << 6) + (hash >> 2);
+	return HashBytes(reinterpret_cast<const uint8_t*>(image.rawData()), image.getHeight() * image.getWidth() * sizeof(RGB),
+					 image.getHeight() << 32 | image.getWidth());
+}
+
+uint32_t Palette::add(const RGB& color) {
+	pair<unordered_map<RGB, uint32_t, RGBHash>::const_iterator, bool> res =
+		indices.insert(make_pair(color, colors.size()));
+	if (res.second)
+		colors.push_back(color);
+	return res.first->second;
+}
+
+uint32_t Palette::size() const {
+	return colors.size();
+}
+
+optional<uint32_t> Palette::find(const RGB& color) const {
+	unordered_map<RGB, uint32_t, RGBHash>::const_iterator it = indices.find(color);
+	if (it == indices.end())
+		return nullopt;
+	return it->second;
+}
+
+const RGB& Palette::operator[](uint32_t index) const {
+	return colors[index];
+}
+
+IndexedImage::IndexedImage(size_t height, size_t width, uint32_t index_size)
+	: Array2D<uint8_t>(height, width * index_size), index_size(index_size) {}
+
+IndexedImage::IndexedImage(size_t height, size_t width, const Palette& palette)
+	: IndexedImage(height, width, palette.size() <= 256 ? 1 : 2) {
+	if (palette.size() > 65536)
+		throw length_error("Palette is too large for an indexed image");
+}
+
+size_t IndexedImage::getHeight() const {
+	return size[0];
+}
+
+size_t IndexedImage::getWidth() const {
+	return size[1] / index_size;
+}
+
+uint32_t IndexedImage::indexSize() const {
+	return index_size;
+}
+
+uint8_t* IndexedImage::rawData() {
+	return data.data();
+}
+
+const uint8_t* IndexedImage::rawData() const {
+	return data.data();
+}
+
+size_t IndexedImage::rawSize() const {
+	return data.size();
+}
+
+uint32_t IndexedImage::get(size_t i, size_t j) const {
+	if (index_size == 1)
+		return (*this)(i, j);
+	uint16_t index;
+	memcpy(&index, &(*this)(i, 2 * j), sizeof(index));
+	return index;
+}
+
+void IndexedImage::set(size_t i, size_t j, uint32_t index) {
+	if (index_size == 1)
+		(*this)(i, j) = index;
+	else {
+		uint16_t value = index;
+		memcpy(&(*this)(i, 2 * j), &value, sizeof(value));
 	}
-	return hash;
+}
+
+IndexedImage IndexedImage::crop(size_t i0, size_t j0, size_t height, size_t width) const {
+	if (i0 + height > getHeight() || j0 + width > getWidth())
+		throw out_of_range("Crop out of bounds");
+	IndexedImage result(height, width, index_size);
+	for (size_t i = 0; i < height; i++)
+		memcpy(&result.data[i * width * index_size], &data[((i0 + i) * getWidth() + j0) * index_size],
+			   width * index_size);
+	return result;
+}
+
+Image IndexedImage::toImage(const Palette& palette) const {
+	Image image(getHeight(), getWidth());
+	for (size_t i = 0; i < getHeight(); i++)
+		for (size_t j = 0; j < getWidth(); j++)
+			image(i, j) = palette[get(i, j)];
+	return image;
+}
+
+bool IndexedImage::operator==(const IndexedImage& image) const {
+	if (size != image.size || index_size != image.index_size)
+		return false;
+	return data.empty() || memcmp(data.data(), image.data.data(), data.size()) == 0;
+}
+
+size_t IndexedImageHash::operator()(const IndexedImage& image) const {
+	return HashBytes(image.rawData(), image.rawSize(), image.getHeight() << 32 | image.getWidth());
 }
 
 Image LoadImage(const string& path) {
 	int width, height, num_components;
-	stbi_set_flip_vertically_on_load(false);
+	stbi_set_flip_vertically_on_load_thread(false);
 	uint8_t* data = stbi_load(path.c_str(), &width, &height, &num_components, STBI_rgb);
 	if (data == nullptr)
 		throw runtime_error("Failed to load image: " + path);
-	Image image = Image(height, width);
-	for (int i = 0; i < height; i++) {
-		for (int j = 0; j < width; j++) {
-			uint32_t index = STBI_rgb * (i * width + j);
-			RGB pixel = {data[index], data[index + 1], data[index + 2]};
-			image(i, j) = pixel;
-		}
-	}
+	// The decoded buffer is already packed RGB, a vector can't adopt it so it's copied in one pass and freed
+	Image image(height, width, reinterpret_cast<const RGB*>(data));
 	stbi_image_free(data);
 	return image;
 }
 
-void SaveImagePNG(const string& path, const Image& image) {
-	stbi_flip_vertically_on_write(false);
-	stbi_write_png(path.c_str(), image.getWidth(), image.getHeight(), STBI_rgb,
-				   reinterpret_cast<const uint8_t*>(image.rawData()), 0);
+ImageFormat ParseImageFormat(const string& name) {
+	if (name == "png")
+		return ImageFormat::PNG;
+	if (name == "ppm")
+		return ImageFormat::PPM;
+	if (name == "qoi")
+		return ImageFormat::QOI;
+	if (name == "raw")
+		return ImageFormat::RAW;
+	throw invalid_argument("Unknown image format: " + name);
+}
+
+const char* ImageFormatExtension(ImageFormat format) {
+	switch (format) {
+	case ImageFormat::PPM:
+		return "ppm";
+	case ImageFormat::QOI:
+		return "qoi";
+	case ImageFormat::RAW:
+		return "rgb";
+	case ImageFormat::PNG:
+	default:
+		return "png";
+	}
+}
+
+static void appendBigEndian(vector<uint8_t>& buffer, uint32_t value) {
+	buffer.push_back(value >> 24);
+	buffer.push_back(value >> 16);
+	buffer.push_back(value >> 8);
+	buffer.push_back(value);
+}
+
+static uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc) {
+	static const vector<uint32_t> table = [] {
+		vector<uint32_t> table(256);
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (uint32_t k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		return table;
+	}();
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void appendChunk(vector<uint8_t>& buffer, const char* type, const uint8_t* data, size_t size) {
+	appendBigEndian(buffer, size);
+	size_t start = buffer.size();
+	buffer.insert(buffer.end(), type, type + 4);
+	buffer.insert(buffer.end(), data, data + size);
+	appendBigEndian(buffer, ~crc32(&buffer[start], size + 4, 0xFFFFFFFF));
+}
+
+static uint8_t paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc)
+		return a;
+	return pb <= pc ? b : c;
+}
+
+// Filters every RGB row with the filter minimizing the sum of absolute differences, like stb
+static vector<uint8_t> filterRGB(const Image& image) {
+	size_t stride = image.getWidth() * sizeof(RGB);
+	const uint8_t* data = reinterpret_cast<const uint8_t*>(image.rawData());
+	vector<uint8_t> zeroes(stride, 0);
+	vector<uint8_t> filtered((stride + 1) * image.getHeight());
+	vector<uint8_t> line(stride);
+	for (size_t i = 0; i < image.getHeight(); i++) {
+		const uint8_t* row = data + i * stride;
+		const uint8_t* up = i > 0 ? row - stride : zeroes.data();
+		uint8_t* output = &filtered[i * (stride + 1)];
+		uint32_t best_estimate = UINT32_MAX;
+		for (uint8_t filter = 0; filter < 5; filter++) {
+			for (size_t x = 0; x < stride; x++) {
+				int left = x >= sizeof(RGB) ? row[x - sizeof(RGB)] : 0;
+				int up_left = x >= sizeof(RGB) ? up[x - sizeof(RGB)] : 0;
+				uint8_t prediction = 0;
+				if (filter == 1)
+					prediction = left;
+				else if (filter == 2)
+					prediction = up[x];
+				else if (filter == 3)
+					prediction = (left + up[x]) >> 1;
+				else if (filter == 4)
+					prediction = paeth(left, up[x], up_left);
+				line[x] = row[x] - prediction;
+			}
+			uint32_t estimate = 0;
+			for (size_t x = 0; x < stride; x++)
+				estimate += abs(static_cast<int8_t>(line[x]));
+			if (estimate < best_estimate) {
+				best_estimate = estimate;
+				output[0] = filter;
+				memcpy(output + 1, line.data(), stride);
+			}
+		}
+	}
+	return filtered;
+}
+
+// Packs the indices of every row most significant bits first, unfiltered as recommended for palettes
+static optional<vector<uint8_t>> packIndices(const Image& image, const Palette& palette, uint32_t bit_depth) {
+	size_t stride = (image.getWidth() * bit_depth + 7) / 8;
+	vector<uint8_t> packed((stride + 1) * image.getHeight(), 0);
+	const RGB* data = image.rawData();
+	RGB last_color = data[0];
+	optional<uint32_t> last_index = palette.find(last_color);
+	for (size_t i = 0; i < image.getHeight(); i++) {
+		uint8_t* row = &packed[i * (stride + 1) + 1];
+		for (size_t j = 0; j < image.getWidth(); j++) {
+			const RGB& color = data[i * image.getWidth() + j];
+			// Outputs are mostly runs of the same color
+			if (color != last_color) {
+				last_color = color;
+				last_index = palette.find(color);
+			}
+			if (!last_index.has_value())
+				return nullopt;
+			size_t bit = j * bit_depth;
+			row[bit / 8] |= last_index.value() << (8 - bit_depth - bit % 8);
+		}
+	}
+	return packed;
+}
+
+static const uint8_t PNG_SIGNATURE[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+static const uint8_t PNG_COLOR_RGB = 2;
+static const uint8_t PNG_COLOR_INDEXED = 3;
+
+static vector<uint8_t> zlibCompress(const vector<uint8_t>& data, int compression_level) {
+	int compressed_size;
+	uint8_t* compressed = stbi_zlib_compress(const_cast<uint8_t*>(data.data()), data.size(), &compressed_size,
+											 compression_level);
+	if (compressed == nullptr)
+		throw runtime_error("Failed to compress image");
+	vector<uint8_t> buffer(compressed, compressed + compressed_size);
+	STBIW_FREE(compressed);
+	return buffer;
+}
+
+// Signature and IHDR chunk
+static vector<uint8_t> pngHeader(uint32_t height, uint32_t width, uint8_t bit_depth, uint8_t color_type) {
+	vector<uint8_t> buffer(PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+	vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	header.insert(header.end(), {bit_depth, color_type, 0, 0, 0});
+	appendChunk(buffer, "IHDR", header.data(), header.size());
+	return buffer;
+}
+
+static void writeFile(const string& path, const vector<uint8_t>& buffer) {
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		throw runtime_error("Failed to write image: " + path);
+	bool success = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	success = fclose(file) == 0 && success;
+	if (!success)
+		throw runtime_error("Failed to write image: " + path);
+}
+
+static vector<uint8_t> encodePNG(const Image& image, const Palette* palette, int compression_level) {
+	uint8_t bit_depth = 8;
+	uint8_t color_type = PNG_COLOR_RGB;
+	optional<vector<uint8_t>> filtered;
+	if (palette != nullptr && palette->size() <= 256 && image.getHeight() * image.getWidth() > 0) {
+		while (bit_depth > 1 && palette->size() <= (1u << (bit_depth / 2)))
+			bit_depth /= 2;
+		filtered = packIndices(image, *palette, bit_depth);
+		if (filtered.has_value())
+			color_type = PNG_COLOR_INDEXED;
+		else
+			bit_depth = 8;
+	}
+	if (!filtered.has_value())
+		filtered = filterRGB(image);
+
+	vector<uint8_t> compressed = zlibCompress(filtered.value(), compression_level);
+	vector<uint8_t> buffer = pngHeader(image.getHeight(), image.getWidth(), bit_depth, color_type);
+	if (color_type == PNG_COLOR_INDEXED) {
+		vector<uint8_t> colors;
+		for (uint32_t k = 0; k < palette->size(); k++)
+			colors.insert(colors.end(), {(*palette)[k].r, (*palette)[k].g, (*palette)[k].b});
+		appendChunk(buffer, "PLTE", colors.data(), colors.size());
+	}
+	appendChunk(buffer, "IDAT", compressed.data(), compressed.size());
+	appendChunk(buffer, "IEND", nullptr, 0);
+	return buffer;
+}
+
+static vector<uint8_t> encodePixels(const string& header, const Image& image) {
+	const uint8_t* pixels = reinterpret_cast<const uint8_t*>(image.rawData());
+	vector<uint8_t> buffer(header.begin(), header.end());
+	buffer.insert(buffer.end(), pixels, pixels + image.getHeight() * image.getWidth() * sizeof(RGB));
+	return buffer;
+}
+
+static vector<uint8_t> encodePPM(const Image& image) {
+	return encodePixels("P6\n" + to_string(image.getWidth()) + " " + to_string(image.getHeight()) + "\n255\n", image);
+}
+
+// https://qoiformat.org/qoi-specification.pdf, encoded in a single pass
+static vector<uint8_t> encodeQOI(const Image& image) {
+	const uint8_t OP_INDEX = 0x00;
+	const uint8_t OP_DIFF = 0x40;
+	const uint8_t OP_LUMA = 0x80;
+	const uint8_t OP_RUN = 0xC0;
+	const uint8_t OP_RGB = 0xFE;
+
+	size_t length = image.getHeight() * image.getWidth();
+	vector<uint8_t> buffer;
+	buffer.reserve(14 + 4 * length + 8);
+	buffer.insert(buffer.end(), {'q', 'o', 'i', 'f'});
+	appendBigEndian(buffer, image.getWidth());
+	appendBigEndian(buffer, image.getHeight());
+	buffer.push_back(3); // RGB
+	buffer.push_back(0); // sRGB with linear alpha
+
+	// Entries start with transparent black, which an opaque pixel never matches
+	RGB index[64] = {};
+	bool used[64] = {};
+	RGB previous = {0, 0, 0};
+	uint32_t run = 0;
+	const RGB* data = image.rawData();
+	for (size_t i = 0; i < length; i++) {
+		const RGB& pixel = data[i];
+		if (pixel == previous) {
+			run++;
+			if (run == 62 || i == length - 1) {
+				buffer.push_back(OP_RUN | (run - 1));
+				run = 0;
+			}
+			continue;
+		}
+		if (run > 0) {
+			buffer.push_back(OP_RUN | (run - 1));
+			run = 0;
+		}
+
+		// Alpha is always 255
+		uint32_t hash = (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + 255 * 11) % 64;
+		if (used[hash] && index[hash] == pixel) {
+			buffer.push_back(OP_INDEX | hash);
+		} else {
+			index[hash] = pixel;
+			used[hash] = true;
+			int8_t dr = pixel.r - previous.r;
+			int8_t dg = pixel.g - previous.g;
+			int8_t db = pixel.b - previous.b;
+			int8_t dr_dg = dr - dg;
+			int8_t db_dg = db - dg;
+			if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+				buffer.push_back(OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+			else if (dr_dg > -9 && dr_dg < 8 && dg > -33 && dg < 32 && db_dg > -9 && db_dg < 8) {
+				buffer.push_back(OP_LUMA | (dg + 32));
+				buffer.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+			} else
+				buffer.insert(buffer.end(), {OP_RGB, pixel.r, pixel.g, pixel.b});
+		}
+		previous = pixel;
+	}
+	buffer.insert(buffer.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+	return buffer;
+}
+
+static vector<uint8_t> encodeRaw(const Image& image) {
+	string header = "RGB8";
+	uint32_t sizes[2] = {static_cast<uint32_t>(image.getWidth()), static_cast<uint32_t>(image.getHeight())};
+	for (uint32_t k = 0; k < 2; k++)
+		for (uint32_t shift = 0; shift < 32; shift += 8)
+			header.push_back(static_cast<char>(sizes[k] >> shift));
+	return encodePixels(header, image);
+}
+
+vector<uint8_t> EncodeImage(const Image& image, const ImageEncoding& encoding) {
+	switch (encoding.format) {
+	case ImageFormat::PPM:
+		return encodePPM(image);
+	case ImageFormat::QOI:
+		return encodeQOI(image);
+	case ImageFormat::RAW:
+		return encodeRaw(image);
+	case ImageFormat::PNG:
+	default:
+		return encodePNG(image, encoding.palette.get(), encoding.compression_level);
+	}
+}
+
+void SaveImage(const string& path, const Image& image, const ImageEncoding& encoding) {
+	writeFile(path, EncodeImage(image, encoding));
+}
+
+APNGEncoder::APNGEncoder(uint32_t height, uint32_t width, uint32_t delay_ms, int compression_level)
+	: height(height), width(width), delay_ms(delay_ms), compression_level(compression_level), frames(0),
+	  sequence(0) {}
+
+void APNGEncoder::add(uint32_t i, uint32_t j, const Image& region) {
+	if (frames == 0 && (i != 0 || j != 0 || region.getHeight() != height || region.getWidth() != width))
+		throw invalid_argument("The first frame of an animation must cover it entirely");
+	if (i + region.getHeight() > height || j + region.getWidth() > width || region.getHeight() * region.getWidth() == 0)
+		throw invalid_argument("Animation frame out of bounds");
+
+	// Frames are drawn over the previous one, which is kept as is
+	vector<uint8_t> control;
+	appendBigEndian(control, sequence++);
+	appendBigEndian(control, region.getWidth());
+	appendBigEndian(control, region.getHeight());
+	appendBigEndian(control, j);
+	appendBigEndian(control, i);
+	control.insert(control.end(), {static_cast<uint8_t>(delay_ms >> 8), static_cast<uint8_t>(delay_ms), 3, 232, 0, 0});
+	appendChunk(chunks, "fcTL", control.data(), control.size());
+
+	vector<uint8_t> compressed = zlibCompress(filterRGB(region), compression_level);
+	if (frames == 0)
+		appendChunk(chunks, "IDAT", compressed.data(), compressed.size());
+	else {
+		vector<uint8_t> data;
+		appendBigEndian(data, sequence++);
+		data.insert(data.end(), compressed.begin(), compressed.end());
+		appendChunk(chunks, "fdAT", data.data(), data.size());
+	}
+	frames++;
+}
+
+void APNGEncoder::clear() {
+	chunks.clear();
+	frames = 0;
+	sequence = 0;
+}
+
+void APNGEncoder::save(const string& path) const {
+	if (frames == 0)
+		throw logic_error("Empty animation");
+	vector<uint8_t> buffer = pngHeader(height, width, 8, PNG_COLOR_RGB);
+	vector<uint8_t> control;
+	appendBigEndian(control, frames);
+	appendBigEndian(control, 0); // Loops forever
+	appendChunk(buffer, "acTL", control.data(), control.size());
+	buffer.insert(buffer.end(), chunks.begin(), chunks.end());
+	appendChunk(buffer, "IEND", nullptr, 0);
+	writeFile(path, buffer);
 }
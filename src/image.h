@@ -1,8 +1,11 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
+#include <memory>
+#include <optional>
 #include <stdint.h>
 #include <string>
+#include <unordered_map>
 
 #include "multi_array.h"
 
@@ -20,8 +23,10 @@ private:
 	size_t width() const;
 public:
 	Image(size_t height, size_t width);
+	Image(size_t height, size_t width, const RGB* pixels); // Rows without padding, copied in one pass
 	size_t getHeight() const;
 	size_t getWidth() const;
+	RGB* rawData();
 	const RGB* rawData() const;
 	Image rotate() const;
 	Image mirror() const;
@@ -37,7 +42,75 @@ struct ImageHash {
 	size_t operator()(const Image& image) const;
 };
 
+class Palette {
+private:
+	vector<RGB> colors;
+	unordered_map<RGB, uint32_t, RGBHash> indices;
+public:
+	uint32_t add(const RGB& color); // Index of the color, added if it's new
+	optional<uint32_t> find(const RGB& color) const;
+	uint32_t size() const;
+	const RGB& operator[](uint32_t index) const;
+};
+
+// Pixels are indices into a palette shared with other images, stored in
+// one byte for palettes of up to 256 colors and two bytes otherwise
+class IndexedImage : public Array2D<uint8_t> {
+private:
+	uint32_t index_size;
+	IndexedImage(size_t height, size_t width, uint32_t index_size);
+public:
+	IndexedImage(size_t height, size_t width, const Palette& palette);
+	size_t getHeight() const;
+	size_t getWidth() const;
+	uint32_t indexSize() const;
+	uint8_t* rawData();
+	const uint8_t* rawData() const;
+	size_t rawSize() const;
+	uint32_t get(size_t i, size_t j) const;
+	void set(size_t i, size_t j, uint32_t index);
+	IndexedImage crop(size_t i, size_t j, size_t height, size_t width) const;
+	Image toImage(const Palette& palette) const;
+	bool operator==(const IndexedImage& image) const;
+};
+
+struct IndexedImageHash {
+	size_t operator()(const IndexedImage& image) const;
+};
+
+enum class ImageFormat { PNG, PPM, QOI, RAW };
+
+ImageFormat ParseImageFormat(const string& name);
+const char* ImageFormatExtension(ImageFormat format);
+
+struct ImageEncoding {
+	ImageFormat format;
+	int compression_level;             // PNG only, higher compresses more, 5 and below are the same
+	shared_ptr<const Palette> palette; // Colors the image may contain, PNGs are indexed if there are at most 256
+};
+
 Image LoadImage(const string& path);
-void SaveImagePNG(const string& path, const Image& image);
+// PNGs use 1, 2, 4 or 8-bit palette indices when every pixel is in the palette, RGB otherwise
+// Raw images are the magic "RGB8", little endian 32-bit width and height, then the pixels
+vector<uint8_t> EncodeImage(const Image& image, const ImageEncoding& encoding);
+void SaveImage(const string& path, const Image& image, const ImageEncoding& encoding);
+
+// Animated PNG built one frame at a time, each frame replaces a region of the previous one
+// The first frame covers the whole animation and is also the image shown by viewers without APNG support
+class APNGEncoder {
+private:
+	uint32_t height;
+	uint32_t width;
+	uint32_t delay_ms;
+	int compression_level;
+	uint32_t frames;
+	uint32_t sequence;
+	vector<uint8_t> chunks; // Compressed frames with their control chunks
+public:
+	APNGEncoder(uint32_t height, uint32_t width, uint32_t delay_ms, int compression_level);
+	void add(uint32_t i, uint32_t j, const Image& region);
+	void clear();
+	void save(const string& path) const;
+};
 
 #endif
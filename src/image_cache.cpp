@@ -0,0 +1,41 @@
+#include "image_cache.h"
+#include "thread_pool.h"
+
+Image ImageCache::load(const string& path) {
+	return load(vector<string>{path})[0];
+}
+
+vector<Image> ImageCache::load(const vector<string>& paths) {
+	vector<filesystem::file_time_type> modified(paths.size());
+	for (uint32_t i = 0; i < paths.size(); i++) {
+		error_code error;
+		modified[i] = filesystem::last_write_time(paths[i], error);
+	}
+
+	vector<Image> images(paths.size(), Image(0, 0));
+	vector<uint32_t> missing;
+	{
+		lock_guard<mutex> lock(entries_mutex);
+		for (uint32_t i = 0; i < paths.size(); i++) {
+			unordered_map<string, Entry>::const_iterator it = entries.find(paths[i]);
+			if (it != entries.end() && it->second.modified == modified[i])
+				images[i] = it->second.image;
+			else
+				missing.push_back(i);
+		}
+	}
+
+	ThreadPool::global().parallelFor(missing.size(), [&](size_t k) {
+		images[missing[k]] = LoadImage(paths[missing[k]]);
+	});
+
+	lock_guard<mutex> lock(entries_mutex);
+	for (vector<uint32_t>::const_iterator it = missing.begin(); it != missing.end(); it++)
+		entries.insert_or_assign(paths[*it], Entry{modified[*it], images[*it]});
+	return images;
+}
+
+ImageCache& ImageCache::global() {
+	static ImageCache cache;
+	return cache;
+}
@@ -0,0 +1,30 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "image.h"
+
+using namespace std;
+
+// Decoded images shared by every model of the run, a file is decoded again only if it was modified
+class ImageCache {
+private:
+	struct Entry {
+		filesystem::file_time_type modified;
+		Image image;
+	};
+	mutex entries_mutex;
+	unordered_map<string, Entry> entries;
+public:
+	Image load(const string& path);
+	// Missing images are decoded in parallel
+	vector<Image> load(const vector<string>& paths);
+	static ImageCache& global();
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdexcept>
+#include <stdio.h>
+
+#include "image_writer.h"
+
+// First job whose path isn't being written, keeps writes to the same path in order
+deque<ImageWriter::Job>::iterator ImageWriter::nextJob() {
+	deque<Job>::iterator it = jobs.begin();
+	while (it != jobs.end() && writing.count(it->path) != 0)
+		it++;
+	return it;
+}
+
+void ImageWriter::work() {
+	while (true) {
+		unique_lock<mutex> lock(queue_mutex);
+		not_empty.wait(lock, [this] { return (stopping && jobs.empty()) || nextJob() != jobs.end(); });
+		if (jobs.empty())
+			return;
+		deque<Job>::iterator it = nextJob();
+		Job job = move(*it);
+		jobs.erase(it);
+		writing.insert(job.path);
+		active++;
+		lock.unlock();
+		not_full.notify_one();
+
+		try {
+			SaveImage(job.path, job.image, job.encoding);
+		} catch (const exception& e) {
+			printf("[Warning] %s\n", e.what());
+		}
+
+		lock.lock();
+		writing.erase(job.path);
+		active--;
+		if (jobs.empty() && active == 0)
+			idle.notify_all();
+		// A job waiting for this path may be runnable now
+		not_empty.notify_all();
+	}
+}
+
+ImageWriter::ImageWriter(uint32_t threads, size_t capacity)
+	: capacity(max<size_t>(1, capacity)), stopping(false), active(0) {
+	for (uint32_t i = 0; i < max(1u, threads); i++)
+		workers.emplace_back(&ImageWriter::work, this);
+}
+
+ImageWriter::~ImageWriter() {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	// Workers drain the queue before exiting
+	not_empty.notify_all();
+	for (vector<thread>::iterator it = workers.begin(); it != workers.end(); it++)
+		it->join();
+}
+
+void ImageWriter::write(const string& path, Image&& image, const ImageEncoding& encoding, uint64_t order) {
+	{
+		unique_lock<mutex> lock(queue_mutex);
+		not_full.wait(lock, [this] { return jobs.size() < capacity; });
+		pair<unordered_map<string, uint64_t>::iterator, bool> res = orders.insert({path, order});
+		if (!res.second) {
+			if (res.first->second > order)
+				return;
+			res.first->second = order;
+		}
+		jobs.push_back({path, move(image), encoding});
+	}
+	not_empty.notify_one();
+}
+
+void ImageWriter::flush() {
+	unique_lock<mutex> lock(queue_mutex);
+	idle.wait(lock, [this] { return jobs.empty() && active == 0; });
+}
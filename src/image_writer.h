@@ -0,0 +1,48 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "image.h"
+
+using namespace std;
+
+// Encodes and writes images on background threads so generation and compression overlap
+// At most capacity images wait in the queue, producers block until there is room
+// Images written to the same path are written one at a time, and only the one with the highest order is kept
+class ImageWriter {
+private:
+	struct Job {
+		string path;
+		Image image;
+		ImageEncoding encoding;
+	};
+	const size_t capacity;
+	bool stopping;
+	size_t active;
+	mutex queue_mutex;
+	condition_variable not_empty;
+	condition_variable not_full;
+	condition_variable idle;
+	deque<Job> jobs;
+	unordered_map<string, uint64_t> orders; // Highest order written to each path
+	unordered_set<string> writing;
+	vector<thread> workers;
+	deque<Job>::iterator nextJob();
+	void work();
+public:
+	ImageWriter(uint32_t threads, size_t capacity);
+	~ImageWriter();
+	void write(const string& path, Image&& image, const ImageEncoding& encoding, uint64_t order);
+	void flush(); // Waits until every queued image is written
+};
+
+#endif
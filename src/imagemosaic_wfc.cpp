@@ -1,71 +1,100 @@
 #include <assert.h>
+#include <chrono>
 #include <stdexcept>
 
 #include "imagemosaic_wfc.h"
 
-ImageWeight::ImageWeight(const Image& image, double weight) : image(image), weight(weight) {}
+using namespace chrono;
+using hrc = high_resolution_clock;
 
-vector<uint32_t> ImagemosaicWFC::generatePatterns() {
-	vector<uint32_t> patterns;
-	patterns.resize(tiles.size());
-	for (uint32_t i = 0; i < tiles.size(); i++)
-		patterns[i] = i;
-	return patterns;
-}
+ImageWeight::ImageWeight(const Image& image, double weight) : image(image), weight(weight) {}
 
-vector<double> ImagemosaicWFC::computeWeights() const {
+static vector<double> computeWeights(const vector<ImageWeight>& tiles) {
 	vector<double> weights(tiles.size());
 	for (uint32_t i = 0; i < tiles.size(); i++)
 		weights[i] = tiles[i].weight;
 	return weights;
 }
 
-Image ImagemosaicWFC::toImage(const Array2D<uint32_t>& output_patterns) const {
-	uint32_t height = output_patterns.getSize(0);
-	uint32_t width = output_patterns.getSize(1);
-	uint32_t size = tiles[0].image.getHeight();
-	Image output(height * size, width * size);
-	for (uint32_t i = 0; i < height; i++) {
-		for (uint32_t j = 0; j < width; j++) {
-			uint32_t pattern = patterns[output_patterns(i, j)];
-			for (uint32_t dy = 0; dy < size; dy++)
-				for (uint32_t dx = 0; dx < size; dx++)
-					output(i * size + dy, j * size + dx) = tiles[pattern].image(dy, dx);
-		}
-	}
-	return output;
-}
-
-PropagatorState ImagemosaicWFC::generatePropagator(const Array3D<uint8_t>& neighbors) const {
-	uint32_t tile_count = tiles.size();
-	PropagatorState state(Propagator::DIRECTIONS, tile_count);
-	for (uint32_t dir = 0; dir < Propagator::DIRECTIONS; dir++)
+static PropagatorState generatePropagator(uint32_t tile_count, const Array3D<uint8_t>& neighbors) {
+	PropagatorState state(Topology::DIRECTIONS, tile_count);
+	for (uint32_t dir = 0; dir < Topology::DIRECTIONS; dir++)
 		for (uint32_t i = 0; i < tile_count; i++)
 			for (uint32_t j = 0; j < tile_count; j++)
-				if (neighbors(dir, i, j) || neighbors(Propagator::Opposite[dir], j, i)) {
+				if (neighbors(dir, i, j) || neighbors(Topology::Opposite[dir], j, i)) {
 					if (!neighbors(dir, i, j))
-						printf("[Warning] Missing neighbor %d-%d (x=%d, y=%d)\n", i, j, Propagator::DIRECTION[dir].j,
-							   -Propagator::DIRECTION[dir].i);
+						printf("[Warning] Missing neighbor %d-%d (x=%d, y=%d)\n", i, j, Topology::DIRECTION[dir].j,
+							   -Topology::DIRECTION[dir].i);
 					state(dir, i).push_back(j);
 				}
 	return state;
 }
 
+CompiledModel ImagemosaicWFC::compile(const vector<ImageWeight>& tiles, const Array3D<uint8_t>& neighbors) {
+	vector<Image> images;
+	images.reserve(tiles.size());
+	for (uint32_t i = 0; i < tiles.size(); i++)
+		images.push_back(tiles[i].image);
+	CompiledModel model(images, generatePropagator(tiles.size(), neighbors));
+	model.orientations = vector<uint32_t>(tiles.size(), 1);
+	model.setWeights(computeWeights(tiles));
+	return model;
+}
+
+ImagemosaicWFC::ImagemosaicWFC(vec2 size, shared_ptr<const CompiledModel> model, shared_ptr<const TileAtlas> atlas,
+							   const WFCOptions& options)
+	: options(options), atlas(atlas), wfc(size, model, options.periodic_output, options.memory), render_time(0) {}
+
 ImagemosaicWFC::ImagemosaicWFC(vec2 size, const vector<ImageWeight>& tiles, const Array3D<uint8_t>& neighbors,
 							   const WFCOptions& options)
-	: options(options), tiles(tiles), patterns(generatePatterns()),
-	  wfc(size, generatePropagator(neighbors), computeWeights(), options.periodic_output) {}
+	: ImagemosaicWFC(size, make_shared<const CompiledModel>(compile(tiles, neighbors)), options) {}
+
+ImagemosaicWFC::ImagemosaicWFC(vec2 size, shared_ptr<const CompiledModel> model, const WFCOptions& options)
+	: ImagemosaicWFC(size, model, make_shared<const TileAtlas>(model->images), options) {}
 
 void ImagemosaicWFC::setTile(vec2 index, uint32_t pattern) {
-	for (uint32_t p = 0; p < patterns.size(); p++)
-		if (pattern != p)
-			wfc.collapse(index, p);
+	if (pattern >= atlas->size())
+		throw out_of_range("Tile index out of range");
+	vector<uint8_t> allowed(atlas->size(), false);
+	allowed[pattern] = true;
+	wfc.constrain(vec3(index), vec3(1, 1, 1), allowed);
 }
 
-optional<Image> ImagemosaicWFC::execute(int seed) {
+shared_ptr<const WFCState> ImagemosaicWFC::setConstraints(const Array2D<uint8_t>& allowed) {
+	return wfc.setInitialConstraints(allowed);
+}
+
+void ImagemosaicWFC::setConstraints(shared_ptr<const WFCState> state) {
+	wfc.setInitialState(state);
+}
+
+optional<Array2D<uint32_t>> ImagemosaicWFC::solve(int seed) {
 	wfc.init();
-	optional<Array2D<uint32_t>> result = wfc.execute(seed);
-	if (result.has_value())
-		return toImage(result.value());
-	return nullopt;
+	return wfc.execute(seed);
+}
+
+Image ImagemosaicWFC::render(const Array2D<uint32_t>& output_patterns) const {
+	return atlas->render(output_patterns);
+}
+
+optional<Image> ImagemosaicWFC::execute(int seed) {
+	optional<Array2D<uint32_t>> result = solve(seed);
+	if (!result.has_value())
+		return nullopt;
+	hrc::time_point start = hrc::now();
+	Image output = render(result.value());
+	render_time += duration<double>(hrc::now() - start).count();
+	return output;
+}
+
+void ImagemosaicWFC::captureFrames(uint32_t interval, uint32_t delay_ms) {
+	wfc.captureFrames(interval, delay_ms);
+}
+
+void ImagemosaicWFC::saveAnimation(const string& path) {
+	wfc.saveAnimation(path);
+}
+
+double ImagemosaicWFC::renderTime() const {
+	return render_time;
 }
@@ -1,13 +1,16 @@
 #ifndef IMAGEMOSAICWFC_H
 #define IMAGEMOSAICWFC_H
 
+#include <memory>
 #include <optional>
 #include <stdint.h>
 #include <vector>
 
+#include "compiled_model.h"
 #include "image.h"
 #include "multi_array.h"
 #include "simpletiled_wfc.h"
+#include "tile_atlas.h"
 #include "wfc.h"
 
 using namespace std;
@@ -21,18 +24,29 @@ struct ImageWeight {
 class ImagemosaicWFC {
 private:
 	const WFCOptions options;
-	const vector<ImageWeight> tiles;
-	const vector<uint32_t> patterns;
+	const shared_ptr<const TileAtlas> atlas; // Shared by every solver of the model
 	WFC wfc;
-	vector<uint32_t> generatePatterns();
-	vector<double> computeWeights() const;
-	Image toImage(const Array2D<uint32_t>& output_patterns) const;
-	PropagatorState generatePropagator(const Array3D<uint8_t>& neighbors) const;
+	double render_time;
+	// With an atlas of its own, for solvers that don't share their model
+	ImagemosaicWFC(vec2 size, shared_ptr<const CompiledModel> model, const WFCOptions& options);
 public:
+	// Only depends on the tiles and their neighbors
+	static CompiledModel compile(const vector<ImageWeight>& tiles, const Array3D<uint8_t>& neighbors);
+	ImagemosaicWFC(vec2 size, shared_ptr<const CompiledModel> model, shared_ptr<const TileAtlas> atlas,
+				   const WFCOptions& options);
 	ImagemosaicWFC(vec2 size, const vector<ImageWeight>& tiles, const Array3D<uint8_t>& neighbors,
 				   const WFCOptions& options);
 	void setTile(vec2 index, uint32_t pattern);
+	// Every following solve starts from the cells restricted to a mask of one byte per pattern each,
+	// the propagated state is returned for solvers of the same size to share
+	shared_ptr<const WFCState> setConstraints(const Array2D<uint8_t>& allowed);
+	void setConstraints(shared_ptr<const WFCState> state);
+	optional<Array2D<uint32_t>> solve(int seed); // Pattern of every cell
+	Image render(const Array2D<uint32_t>& output_patterns) const;
 	optional<Image> execute(int seed);
+	void captureFrames(uint32_t interval, uint32_t delay_ms);
+	void saveAnimation(const string& path);
+	double renderTime() const; // Seconds spent rendering the outputs
 };
 
 #endif
@@ -0,0 +1,368 @@
+#include <stdexcept>
+#include <string.h>
+#include <string>
+
+#include "imagemosaic_wfc.h"
+#include "libwfc.h"
+#include "overlapping_wfc.h"
+#include "simpletiled_wfc.h"
+#include "topology.h"
+
+enum class ModelType { OVERLAPPING, SIMPLETILED, IMAGEMOSAIC, ADJACENCY };
+
+struct wfc_model {
+	ModelType type;
+	shared_ptr<const CompiledModel> model;
+	OverlappingWFCOptions options;     // Overlapping models only
+	shared_ptr<const TileAtlas> atlas; // Simpletiled and imagemosaic models only, shared by their solvers
+};
+
+// Keeps the pattern grid of the last run so it can be copied and rendered separately
+struct wfc_solver {
+	vec2 grid_size;
+	vec2 image_size;
+	optional<Array2D<uint32_t>> result;
+	virtual ~wfc_solver() {}
+	virtual optional<Array2D<uint32_t>> solve(int seed) = 0;
+	virtual Image render(const Array2D<uint32_t>& output_patterns) const = 0;
+};
+
+template <typename WFCType>
+struct Solver : wfc_solver {
+	WFCType wfc;
+	template <typename... Args>
+	Solver(vec2 grid_size, vec2 image_size, Args&&... args) : wfc(forward<Args>(args)...) {
+		this->grid_size = grid_size;
+		this->image_size = image_size;
+	}
+	optional<Array2D<uint32_t>> solve(int seed) override {
+		return wfc.solve(seed);
+	}
+	Image render(const Array2D<uint32_t>& output_patterns) const override {
+		return wfc.render(output_patterns);
+	}
+};
+
+struct wfc_topology {
+	shared_ptr<const Topology> topology;
+};
+
+// Solves the patterns of any topology, without rendering them
+struct GraphSolver : wfc_solver {
+	WFC wfc;
+	GraphSolver(shared_ptr<const Topology> topology, shared_ptr<const CompiledModel> model) : wfc(topology, model) {
+		grid_size = vec2(topology->size.height(), topology->size.width() * topology->size.depth());
+		image_size = vec2(0, 0);
+	}
+	optional<Array2D<uint32_t>> solve(int seed) override {
+		wfc.init();
+		return wfc.execute(seed);
+	}
+	Image render(const Array2D<uint32_t>&) const override {
+		throw logic_error("Only tile and overlapping models on square grids can be rendered");
+	}
+};
+
+static thread_local string last_error;
+
+// Exceptions can't cross the C interface, they are stored for wfc_last_error
+template <typename T, typename Body>
+static T guard(T failure, const Body& body) {
+	try {
+		return body();
+	} catch (const exception& e) {
+		last_error = e.what();
+	} catch (...) {
+		last_error = "Unknown error";
+	}
+	return failure;
+}
+
+static void checkPointer(const void* pointer, const char* name) {
+	if (pointer == nullptr)
+		throw invalid_argument(string(name) + " is null");
+}
+
+static Image toImage(const uint8_t* pixels, uint32_t height, uint32_t width) {
+	checkPointer(pixels, "pixels");
+	if (height == 0 || width == 0)
+		throw invalid_argument("Empty image");
+	Image image(height, width);
+	memcpy(static_cast<void*>(image.rawData()), pixels, static_cast<size_t>(height) * width * sizeof(RGB));
+	return image;
+}
+
+wfc_model* wfc_overlapping_model_create(const uint8_t* pixels, uint32_t height, uint32_t width,
+										const wfc_overlapping_options* options) {
+	return guard<wfc_model*>(nullptr, [&]() {
+		checkPointer(options, "options");
+		if (options->pattern_size == 0 || options->pattern_size > height || options->pattern_size > width)
+			throw invalid_argument("Pattern size must be between 1 and the input size");
+		wfc_model* model = new wfc_model();
+		model->type = ModelType::OVERLAPPING;
+		model->options.pattern_size = options->pattern_size;
+		model->options.symmetry = options->symmetry;
+		model->options.periodic_input = options->periodic_input != 0;
+		model->options.ground = options->ground != 0;
+		try {
+			model->model = make_shared<const CompiledModel>(
+				OverlappingWFC::compile(toImage(pixels, height, width), model->options));
+		} catch (...) {
+			delete model;
+			throw;
+		}
+		return model;
+	});
+}
+
+wfc_model* wfc_simpletiled_model_create(const wfc_tile* tiles, uint32_t tile_count, const wfc_neighbor* neighbors,
+										uint32_t neighbor_count) {
+	return guard<wfc_model*>(nullptr, [&]() {
+		checkPointer(tiles, "tiles");
+		if (neighbor_count > 0)
+			checkPointer(neighbors, "neighbors");
+		vector<Tile> tile_list;
+		for (uint32_t t = 0; t < tile_count; t++) {
+			Symmetry symmetry(tiles[t].symmetry);
+			uint32_t size = tiles[t].size;
+			if (!tiles[t].unique) {
+				tile_list.push_back(Tile(toImage(tiles[t].pixels, size, size), symmetry, tiles[t].weight));
+				continue;
+			}
+			vector<Image> orientations;
+			for (uint32_t o = 0; o < symmetry.orientations(); o++)
+				orientations.push_back(toImage(tiles[t].pixels + static_cast<size_t>(o) * size * size * 3, size, size));
+			tile_list.push_back(Tile(orientations, symmetry, tiles[t].weight));
+		}
+		vector<NeighborIndex> neighbor_list;
+		for (uint32_t n = 0; n < neighbor_count; n++) {
+			if (neighbors[n].left_tile >= tile_count || neighbors[n].right_tile >= tile_count)
+				throw invalid_argument("Neighbor tile out of range");
+			neighbor_list.push_back({neighbors[n].left_tile, neighbors[n].left_orientation, neighbors[n].right_tile,
+									 neighbors[n].right_orientation});
+		}
+		shared_ptr<const CompiledModel> compiled =
+			make_shared<const CompiledModel>(SimpletiledWFC::compile(tile_list, neighbor_list));
+		return new wfc_model{ModelType::SIMPLETILED, compiled, {}, make_shared<const TileAtlas>(compiled->images)};
+	});
+}
+
+wfc_model* wfc_imagemosaic_model_create(const wfc_mosaic_tile* tiles, uint32_t tile_count, const uint8_t* allowed) {
+	return guard<wfc_model*>(nullptr, [&]() {
+		checkPointer(tiles, "tiles");
+		checkPointer(allowed, "allowed");
+		vector<ImageWeight> tile_list;
+		for (uint32_t t = 0; t < tile_count; t++) {
+			if (tiles[t].height != tiles[0].height || tiles[t].width != tiles[0].width)
+				throw invalid_argument("Mosaic tiles must have the same size");
+			tile_list.push_back(ImageWeight(toImage(tiles[t].pixels, tiles[t].height, tiles[t].width), tiles[t].weight));
+		}
+		Array3D<uint8_t> neighbors(Topology::DIRECTIONS, tile_count, tile_count);
+		for (uint32_t dir = 0; dir < Topology::DIRECTIONS; dir++)
+			for (uint32_t a = 0; a < tile_count; a++)
+				for (uint32_t b = 0; b < tile_count; b++)
+					neighbors(dir, a, b) = allowed[(static_cast<size_t>(dir) * tile_count + a) * tile_count + b] != 0;
+		shared_ptr<const CompiledModel> compiled =
+			make_shared<const CompiledModel>(ImagemosaicWFC::compile(tile_list, neighbors));
+		return new wfc_model{ModelType::IMAGEMOSAIC, compiled, {}, make_shared<const TileAtlas>(compiled->images)};
+	});
+}
+
+wfc_model* wfc_adjacency_model_create(const double* weights, uint32_t tile_count, uint32_t direction_count,
+									  const uint8_t* allowed) {
+	return guard<wfc_model*>(nullptr, [&]() {
+		checkPointer(weights, "weights");
+		checkPointer(allowed, "allowed");
+		if (tile_count == 0 || direction_count == 0)
+			throw invalid_argument("Adjacency models need tiles and directions");
+		PropagatorState state(direction_count, tile_count);
+		for (uint32_t dir = 0; dir < direction_count; dir++)
+			for (uint32_t a = 0; a < tile_count; a++)
+				for (uint32_t b = 0; b < tile_count; b++)
+					if (allowed[(static_cast<size_t>(dir) * tile_count + a) * tile_count + b] != 0)
+						state(dir, a).push_back(b);
+		shared_ptr<CompiledModel> compiled = make_shared<CompiledModel>(vector<Image>(), state);
+		compiled->orientations = vector<uint32_t>(tile_count, 1);
+		compiled->setWeights(vector<double>(weights, weights + tile_count));
+		return new wfc_model{ModelType::ADJACENCY, compiled, {}};
+	});
+}
+
+uint32_t wfc_model_pattern_count(const wfc_model* model) {
+	return model == nullptr ? 0 : model->model->size();
+}
+
+wfc_status wfc_model_pattern_tile(const wfc_model* model, uint32_t pattern, uint32_t* tile, uint32_t* orientation) {
+	return guard(WFC_ERROR, [&]() {
+		checkPointer(model, "model");
+		if (model->type == ModelType::OVERLAPPING)
+			throw invalid_argument("Overlapping models have no tiles");
+		// The orientations of each tile are consecutive patterns
+		const vector<uint32_t>& orientations = model->model->orientations;
+		uint32_t first = 0;
+		for (uint32_t t = 0; t < orientations.size(); t++) {
+			if (pattern < first + orientations[t]) {
+				if (tile != nullptr)
+					*tile = t;
+				if (orientation != nullptr)
+					*orientation = pattern - first;
+				return WFC_OK;
+			}
+			first += orientations[t];
+		}
+		throw out_of_range("Pattern out of range");
+	});
+}
+
+void wfc_model_destroy(wfc_model* model) {
+	delete model;
+}
+
+wfc_solver* wfc_solver_create(const wfc_model* model, uint32_t height, uint32_t width, int periodic_output) {
+	return guard<wfc_solver*>(nullptr, [&]() -> wfc_solver* {
+		checkPointer(model, "model");
+		if (height == 0 || width == 0)
+			throw invalid_argument("Empty output");
+		WFCOptions options;
+		options.periodic_output = periodic_output != 0;
+		vec2 size(height, width);
+		if (model->type == ModelType::OVERLAPPING) {
+			OverlappingWFCOptions overlapping = model->options;
+			overlapping.periodic_output = options.periodic_output;
+			overlapping.out_size = size;
+			if (!overlapping.periodic_output && (height < overlapping.pattern_size || width < overlapping.pattern_size))
+				throw invalid_argument("Non periodic outputs can't be smaller than the patterns");
+			return new Solver<OverlappingWFC>(overlapping.getWaveSize(), size, model->model, overlapping);
+		}
+		if (model->type == ModelType::ADJACENCY) {
+			uint32_t directions = model->model->propagator.getSize(0);
+			Topology grid = Topology::grid(vec3(height, width, 1), directions, options.periodic_output);
+			return new GraphSolver(make_shared<const Topology>(grid), model->model);
+		}
+		const Image& tile = model->model->images.at(0);
+		vec2 image_size(height * tile.getHeight(), width * tile.getWidth());
+		if (model->type == ModelType::SIMPLETILED)
+			return new Solver<SimpletiledWFC>(size, image_size, size, model->model, model->atlas, options);
+		return new Solver<ImagemosaicWFC>(size, image_size, size, model->model, model->atlas, options);
+	});
+}
+
+wfc_topology* wfc_hex_topology_create(uint32_t height, uint32_t width, int periodic) {
+	return guard<wfc_topology*>(nullptr, [&]() {
+		if (height == 0 || width == 0)
+			throw invalid_argument("Empty topology");
+		return new wfc_topology{make_shared<const Topology>(Topology::hex(vec2(height, width), periodic != 0))};
+	});
+}
+
+wfc_topology* wfc_graph_topology_create(uint32_t cell_count, uint32_t direction_count, const uint32_t* opposite,
+										const wfc_edge* edges, size_t edge_count) {
+	return guard<wfc_topology*>(nullptr, [&]() {
+		checkPointer(opposite, "opposite");
+		if (edge_count > 0)
+			checkPointer(edges, "edges");
+		if (cell_count == 0 || direction_count == 0)
+			throw invalid_argument("Graphs need cells and directions");
+		vector<Topology::Link> links(edge_count);
+		for (size_t e = 0; e < edge_count; e++)
+			links[e] = {edges[e].source, edges[e].target, edges[e].direction};
+		vector<uint32_t> opposites(opposite, opposite + direction_count);
+		return new wfc_topology{make_shared<const Topology>(Topology(vec3(cell_count, 1, 1), opposites, links))};
+	});
+}
+
+void wfc_topology_destroy(wfc_topology* topology) {
+	delete topology;
+}
+
+// Supports are counted from the opposite direction, which is only right for symmetric rules
+static void checkSymmetric(const PropagatorState& state, const Topology& topology) {
+	uint32_t patterns = state.getSize(1);
+	Array3D<uint8_t> allowed(topology.directions, patterns, patterns);
+	allowed.fill(false);
+	for (uint32_t dir = 0; dir < topology.directions; dir++)
+		for (uint32_t p = 0; p < patterns; p++)
+			for (vector<uint32_t>::const_iterator it = state(dir, p).begin(); it != state(dir, p).end(); it++)
+				allowed(dir, p, *it) = true;
+	for (uint32_t dir = 0; dir < topology.directions; dir++)
+		for (uint32_t p = 0; p < patterns; p++)
+			for (uint32_t q = 0; q < patterns; q++)
+				if (allowed(dir, p, q) != allowed(topology.opposite[dir], q, p))
+					throw invalid_argument("The rules aren't symmetric for the opposite directions of the topology");
+}
+
+wfc_solver* wfc_solver_create_on(const wfc_model* model, const wfc_topology* topology) {
+	return guard<wfc_solver*>(nullptr, [&]() -> wfc_solver* {
+		checkPointer(model, "model");
+		checkPointer(topology, "topology");
+		if (model->model->propagator.getSize(0) != topology->topology->directions)
+			throw invalid_argument("The model and the topology have different directions");
+		checkSymmetric(model->model->propagator, *topology->topology);
+		return new GraphSolver(topology->topology, model->model);
+	});
+}
+
+wfc_status wfc_solver_run(wfc_solver* solver, int seed) {
+	return guard(WFC_ERROR, [&]() {
+		checkPointer(solver, "solver");
+		solver->result = solver->solve(seed);
+		return solver->result.has_value() ? WFC_OK : WFC_CONTRADICTION;
+	});
+}
+
+void wfc_solver_grid_size(const wfc_solver* solver, uint32_t* height, uint32_t* width) {
+	if (height != nullptr)
+		*height = solver == nullptr ? 0 : solver->grid_size.height();
+	if (width != nullptr)
+		*width = solver == nullptr ? 0 : solver->grid_size.width();
+}
+
+void wfc_solver_image_size(const wfc_solver* solver, uint32_t* height, uint32_t* width) {
+	if (height != nullptr)
+		*height = solver == nullptr ? 0 : solver->image_size.height();
+	if (width != nullptr)
+		*width = solver == nullptr ? 0 : solver->image_size.width();
+}
+
+static const Array2D<uint32_t>& lastResult(const wfc_solver* solver) {
+	checkPointer(solver, "solver");
+	if (!solver->result.has_value())
+		throw logic_error("The solver has no result");
+	return solver->result.value();
+}
+
+wfc_status wfc_solver_copy_patterns(const wfc_solver* solver, uint32_t* output, size_t count) {
+	return guard(WFC_ERROR, [&]() {
+		const Array2D<uint32_t>& result = lastResult(solver);
+		checkPointer(output, "output");
+		size_t height = result.getSize(0);
+		size_t width = result.getSize(1);
+		if (count != height * width)
+			throw invalid_argument("Output count doesn't match the grid size");
+		for (size_t i = 0; i < height; i++)
+			for (size_t j = 0; j < width; j++)
+				output[i * width + j] = result(i, j);
+		return WFC_OK;
+	});
+}
+
+wfc_status wfc_solver_copy_rgb(const wfc_solver* solver, uint8_t* output, size_t size) {
+	return guard(WFC_ERROR, [&]() {
+		const Array2D<uint32_t>& result = lastResult(solver);
+		checkPointer(output, "output");
+		Image image = solver->render(result);
+		size_t bytes = image.getHeight() * image.getWidth() * sizeof(RGB);
+		if (size != bytes)
+			throw invalid_argument("Output size doesn't match the image size");
+		memcpy(output, image.rawData(), bytes);
+		return WFC_OK;
+	});
+}
+
+void wfc_solver_destroy(wfc_solver* solver) {
+	delete solver;
+}
+
+const char* wfc_last_error(void) {
+	return last_error.c_str();
+}
@@ -0,0 +1,116 @@
+#ifndef LIBWFC_H
+#define LIBWFC_H
+
+/* C interface of libwfc, built by `make lib` as libwfc.a and libwfc.so
+ * C programs linking the static library also need the C++ runtime (-lstdc++ -lpthread)
+ *
+ * Images are rows of 8-bit RGB pixels without padding
+ * Models are immutable once created and can be shared by solvers on any thread,
+ * a solver must only be used by one thread at a time
+ * Functions that fail return NULL or WFC_ERROR, wfc_last_error() then describes the failure */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WFC_API __attribute__((visibility("default")))
+
+typedef struct wfc_model wfc_model;
+typedef struct wfc_solver wfc_solver;
+typedef struct wfc_topology wfc_topology;
+
+typedef enum wfc_status {
+	WFC_OK = 0,
+	WFC_CONTRADICTION = 1, /* The seed led to a contradiction, the solver can be run again with another one */
+	WFC_ERROR = -1,
+} wfc_status;
+
+typedef struct wfc_overlapping_options {
+	uint32_t pattern_size; /* N */
+	uint32_t symmetry;     /* Number of symmetries of each pattern, 1 to 8 */
+	int periodic_input;
+	int ground; /* Fills the bottom row with the pattern at the bottom middle of the input */
+} wfc_overlapping_options;
+
+typedef struct wfc_tile {
+	const uint8_t* pixels; /* size x size pixels, one image per orientation one after the other if unique */
+	uint32_t size;
+	char symmetry; /* X, T, I, L, \ or F */
+	double weight;
+	int unique; /* Orientations are given instead of being generated by rotating and mirroring */
+} wfc_tile;
+
+/* Tile right in orientation right_orientation can be placed right of tile left in orientation left_orientation */
+typedef struct wfc_neighbor {
+	uint32_t left_tile;
+	uint32_t left_orientation;
+	uint32_t right_tile;
+	uint32_t right_orientation;
+} wfc_neighbor;
+
+typedef struct wfc_mosaic_tile {
+	const uint8_t* pixels; /* height x width pixels, every tile has the same size */
+	uint32_t height;
+	uint32_t width;
+	double weight;
+} wfc_mosaic_tile;
+
+/* Edge from cell source to cell target along a direction of the model */
+typedef struct wfc_edge {
+	uint32_t source;
+	uint32_t target;
+	uint32_t direction;
+} wfc_edge;
+
+WFC_API wfc_model* wfc_overlapping_model_create(const uint8_t* pixels, uint32_t height, uint32_t width,
+												const wfc_overlapping_options* options);
+WFC_API wfc_model* wfc_simpletiled_model_create(const wfc_tile* tiles, uint32_t tile_count,
+												const wfc_neighbor* neighbors, uint32_t neighbor_count);
+/* allowed[(direction * tile_count + a) * tile_count + b] is nonzero if tile b can be placed next to tile a,
+ * directions are up, left, right and down */
+WFC_API wfc_model* wfc_imagemosaic_model_create(const wfc_mosaic_tile* tiles, uint32_t tile_count,
+												const uint8_t* allowed);
+/* Tiles without pixels along any number of directions, allowed is indexed as for imagemosaic models
+ * The rules must be symmetric: b next to a along d if and only if a next to b along the opposite of d */
+WFC_API wfc_model* wfc_adjacency_model_create(const double* weights, uint32_t tile_count, uint32_t direction_count,
+											  const uint8_t* allowed);
+WFC_API uint32_t wfc_model_pattern_count(const wfc_model* model);
+/* Tile and orientation of a pattern of a simpletiled or imagemosaic model */
+WFC_API wfc_status wfc_model_pattern_tile(const wfc_model* model, uint32_t pattern, uint32_t* tile,
+										  uint32_t* orientation);
+WFC_API void wfc_model_destroy(wfc_model* model);
+
+/* The size is in pixels for overlapping models and in tiles otherwise, adjacency models are not rendered */
+WFC_API wfc_solver* wfc_solver_create(const wfc_model* model, uint32_t height, uint32_t width, int periodic_output);
+/* Rows of hexagons, odd rows shifted right by half a cell, the 6 directions are up-left, left, right,
+ * down-right, up-right and down-left, periodic topologies need an even height */
+WFC_API wfc_topology* wfc_hex_topology_create(uint32_t height, uint32_t width, int periodic);
+/* Cells linked by labelled edges, such as the polygons of a navigation mesh
+ * opposite[d] is the direction of the edges going back along d */
+WFC_API wfc_topology* wfc_graph_topology_create(uint32_t cell_count, uint32_t direction_count,
+												const uint32_t* opposite, const wfc_edge* edges, size_t edge_count);
+WFC_API void wfc_topology_destroy(wfc_topology* topology);
+/* Solver on a topology with the directions of the model, its patterns can be copied but not rendered
+ * The grid is height x width for hex topologies and cell_count x 1 for graphs */
+WFC_API wfc_solver* wfc_solver_create_on(const wfc_model* model, const wfc_topology* topology);
+/* Solves from scratch, the result is kept until the next run */
+WFC_API wfc_status wfc_solver_run(wfc_solver* solver, int seed);
+/* Size of the pattern grid and of the rendered image */
+WFC_API void wfc_solver_grid_size(const wfc_solver* solver, uint32_t* height, uint32_t* width);
+WFC_API void wfc_solver_image_size(const wfc_solver* solver, uint32_t* height, uint32_t* width);
+/* Copy the result of the last successful run, count and size must match the grid and the image */
+WFC_API wfc_status wfc_solver_copy_patterns(const wfc_solver* solver, uint32_t* output, size_t count);
+WFC_API wfc_status wfc_solver_copy_rgb(const wfc_solver* solver, uint8_t* output, size_t size);
+WFC_API void wfc_solver_destroy(wfc_solver* solver);
+
+/* Message of the last failure on the calling thread */
+WFC_API const char* wfc_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,28 @@
+#include "model_cache.h"
+
+ModelCache::ModelCache(size_t capacity) : capacity(max<size_t>(1, capacity)) {}
+
+optional<LoadedModel> ModelCache::find(uint64_t key) {
+	lock_guard<mutex> lock(entries_mutex);
+	unordered_map<uint64_t, Entries::iterator>::iterator it = positions.find(key);
+	if (it == positions.end())
+		return nullopt;
+	entries.splice(entries.begin(), entries, it->second);
+	return it->second->second;
+}
+
+void ModelCache::insert(uint64_t key, const LoadedModel& model) {
+	lock_guard<mutex> lock(entries_mutex);
+	unordered_map<uint64_t, Entries::iterator>::iterator it = positions.find(key);
+	if (it != positions.end()) {
+		it->second->second = model;
+		entries.splice(entries.begin(), entries, it->second);
+		return;
+	}
+	entries.push_front({key, model});
+	positions[key] = entries.begin();
+	if (entries.size() > capacity) {
+		positions.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
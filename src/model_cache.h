@@ -0,0 +1,38 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "compiled_model.h"
+#include "tile_atlas.h"
+
+using namespace std;
+
+// A compiled model along with the colors of its outputs, computed once for every output encoding,
+// and the atlas its tiles are rendered from, built once for every solver
+struct LoadedModel {
+	shared_ptr<const CompiledModel> model;
+	shared_ptr<const Palette> colors;
+	shared_ptr<const TileAtlas> atlas; // nullptr for models without tile images
+};
+
+// Compiled models by key, the least recently used one is dropped when there are more than capacity
+class ModelCache {
+private:
+	typedef list<pair<uint64_t, LoadedModel>> Entries;
+	const size_t capacity;
+	mutex entries_mutex;
+	Entries entries; // Most recently used first
+	unordered_map<uint64_t, Entries::iterator> positions;
+public:
+	ModelCache(size_t capacity);
+	optional<LoadedModel> find(uint64_t key);
+	void insert(uint64_t key, const LoadedModel& model);
+};
+
+#endif
@@ -2,18 +2,19 @@
 #define MULTI_ARRAY_H
 
 #include <array>
+#include <memory>
 #include <stdexcept>
 #include <stdint.h>
 #include <vector>
 
 using namespace std;
 
-template <typename T, size_t N>
+template <typename T, size_t N, typename Allocator = allocator<T>>
 class ArrayND {
 protected:
 	// It's turtles all the way down
 	array<size_t, N> size;
-	vector<T> data;
+	vector<T, Allocator> data;
 
 	size_t calculate_index(array<size_t, N> indices) const {
 		for (size_t i = 0; i < N; i++)
@@ -30,7 +31,10 @@ protected:
 	}
 public:
 	template <typename... Sizes>
-	ArrayND(Sizes... sizes) {
+	ArrayND(Sizes... sizes) : ArrayND(Allocator(), sizes...) {}
+
+	template <typename... Sizes>
+	ArrayND(const Allocator& allocator, Sizes... sizes) : data(allocator) {
 		static_assert(sizeof...(sizes) == N, "Number of sizes must match N");
 		array<size_t, N> size_array = {static_cast<size_t>(sizes)...};
 		size_t length = 1;
@@ -91,6 +95,43 @@ struct vec2 {
 	}
 };
 
+// Cell of a grid of layers, k is the layer
+struct vec3 {
+	int i, j, k;
+	vec3() : i(0), j(0), k(0) {}
+	vec3(int i, int j, int k) : i(i), j(j), k(k) {}
+	explicit vec3(const vec2& index) : i(index.i), j(index.j), k(0) {}
+	uint32_t height() const {
+		return static_cast<uint32_t>(i);
+	}
+	uint32_t width() const {
+		return static_cast<uint32_t>(j);
+	}
+	uint32_t depth() const {
+		return static_cast<uint32_t>(k);
+	}
+	uint32_t volume() const {
+		return height() * width() * depth();
+	}
+	vec3 operator+(const vec3& other) const {
+		return vec3(i + other.i, j + other.j, k + other.k);
+	}
+	vec3 operator%(const vec3& other) const {
+		return vec3(i % other.i, j % other.j, k % other.k);
+	}
+	bool inRange(const vec3& size) const {
+		return i >= 0 && j >= 0 && k >= 0 && i < size.i && j < size.j && k < size.k;
+	}
+	// Index of the cell in a grid of the size, layer by layer and row by row
+	uint32_t flatten(const vec3& size) const {
+		return (static_cast<uint32_t>(k) * size.height() + i) * size.width() + j;
+	}
+	static vec3 unflatten(uint32_t cell, const vec3& size) {
+		uint32_t layer = size.height() * size.width();
+		return vec3((cell % layer) / size.width(), cell % size.width(), cell / layer);
+	}
+};
+
 template <typename T>
 using Array2D = ArrayND<T, 2>;
 
@@ -1,10 +1,12 @@
 #ifndef OVERLAPPING_WFC_H
 #define OVERLAPPING_WFC_H
 
+#include <memory>
 #include <optional>
 #include <stdint.h>
 #include <vector>
 
+#include "compiled_model.h"
 #include "image.h"
 #include "wfc.h"
 
@@ -21,18 +23,23 @@ struct OverlappingWFCOptions : WFCOptions {
 
 class OverlappingWFC {
 private:
-	const Image input;
-	const vector<Image> patterns;
+	const shared_ptr<const CompiledModel> model;
+	const Palette& palette;
+	const vector<IndexedImage>& patterns;
+	const optional<uint32_t>& ground;
 	const OverlappingWFCOptions options;
 	WFC wfc;
 	void initGround();
-	PropagatorState generatePropagator() const;
-	Image toImage(const Array2D<uint32_t>& output_patterns) const;
-	OverlappingWFC(const Image& input, const OverlappingWFCOptions& options,
-				   const pair<vector<Image>, vector<double>>& patterns_weights);
 public:
+	// Only depends on the input, pattern size, symmetry and periodic input
+	static CompiledModel compile(const Image& input, const OverlappingWFCOptions& options);
+	OverlappingWFC(shared_ptr<const CompiledModel> model, const OverlappingWFCOptions& options);
 	OverlappingWFC(const Image& input, const OverlappingWFCOptions& options);
+	optional<Array2D<uint32_t>> solve(int seed); // Pattern of every cell of the wave
+	Image render(const Array2D<uint32_t>& output_patterns) const;
 	optional<Image> execute(int seed);
+	void captureFrames(uint32_t interval, uint32_t delay_ms);
+	void saveAnimation(const string& path);
 };
 
 #endif
@@ -0,0 +1,213 @@
+#include <stdexcept>
+
+#include "pattern_extractor.h"
+
+// Odd bases, the pattern hash is the sum of pixel(i, j) * ROW_BASE^i * COL_BASE^j
+static const uint64_t ROW_BASE = 0x9E3779B97F4A7C15ULL;
+static const uint64_t COL_BASE = 0xC2B2AE3D27D4EB4FULL;
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+vec2 Orientation::apply(uint32_t i, uint32_t j, uint32_t size) const {
+	uint32_t u = transpose ? j : i;
+	uint32_t v = transpose ? i : j;
+	return vec2(flip_i ? size - 1 - u : u, flip_j ? size - 1 - v : v);
+}
+
+Orientation Orientation::compose(const Orientation& other) const {
+	if (transpose)
+		return {!other.transpose, flip_i != other.flip_j, flip_j != other.flip_i};
+	return {other.transpose, flip_i != other.flip_i, flip_j != other.flip_j};
+}
+
+// Input converted to palette indices, wrapped around so every window is contiguous
+struct IndexedInput {
+	uint32_t height;
+	uint32_t width;
+	vector<uint64_t> data; // Palette index + 1
+	Palette palette;
+	uint64_t at(vec2 index) const {
+		return data[index.i * width + index.j];
+	}
+};
+
+struct PatternClass {
+	vec2 position;
+	uint32_t seed;
+	Orientation canonical;
+	uint32_t count;
+};
+
+static IndexedInput indexInput(const Image& image, uint32_t height, uint32_t width) {
+	IndexedInput input;
+	input.height = height;
+	input.width = width;
+	input.data.resize(height * width);
+	for (uint32_t i = 0; i < height; i++)
+		for (uint32_t j = 0; j < width; j++)
+			input.data[i * width + j] = input.palette.add(image(i % image.getHeight(), j % image.getWidth())) + 1;
+	return input;
+}
+
+// Hashes every window of n values, element x is weighted by base^x or base^(n - 1 - x) if reversed
+// Each window is obtained from the previous one in constant time
+static void rollingHash(const uint64_t* in, size_t in_stride, uint64_t* out, size_t out_stride, size_t count,
+						uint32_t n, uint64_t base, bool reversed) {
+	uint64_t power = 1;
+	for (uint32_t x = 1; x < n; x++)
+		power *= base;
+
+	uint64_t hash = 0;
+	if (reversed) {
+		for (uint32_t x = 0; x < n; x++)
+			hash = hash * base + in[x * in_stride];
+		out[0] = hash;
+		for (size_t k = 1; k < count; k++) {
+			hash = (hash - in[(k - 1) * in_stride] * power) * base + in[(k + n - 1) * in_stride];
+			out[k * out_stride] = hash;
+		}
+	} else {
+		size_t last = count - 1;
+		for (uint32_t x = n; x > 0; x--)
+			hash = hash * base + in[(last + x - 1) * in_stride];
+		out[last * out_stride] = hash;
+		for (size_t k = last; k > 0; k--) {
+			hash = in[(k - 1) * in_stride] + base * (hash - in[(k + n - 1) * in_stride] * power);
+			out[(k - 1) * out_stride] = hash;
+		}
+	}
+}
+
+// Hash of every window of the input as seen through the orientation, rows first then columns
+static vector<uint64_t> windowHashes(const IndexedInput& input, uint32_t count_i, uint32_t count_j, uint32_t n,
+									 const Orientation& orientation) {
+	uint64_t base_i = orientation.transpose ? COL_BASE : ROW_BASE;
+	uint64_t base_j = orientation.transpose ? ROW_BASE : COL_BASE;
+
+	vector<uint64_t> rows(input.height * count_j);
+	for (uint32_t i = 0; i < input.height; i++)
+		rollingHash(&input.data[i * input.width], 1, &rows[i * count_j], 1, count_j, n, base_j, orientation.flip_j);
+
+	vector<uint64_t> hashes(count_i * count_j);
+	for (uint32_t j = 0; j < count_j; j++)
+		rollingHash(&rows[j], count_j, &hashes[j], count_j, count_i, n, base_i, orientation.flip_i);
+	return hashes;
+}
+
+// Spreads the bits of the polynomial hash, its lowest bits only depend on a few pixels
+static uint64_t mix(uint64_t hash) {
+	hash ^= hash >> 31;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94D049BB133111EBULL;
+	return hash ^ (hash >> 31);
+}
+
+static bool samePattern(const IndexedInput& input, uint32_t n, vec2 position1, const Orientation& orientation1,
+						vec2 position2, const Orientation& orientation2) {
+	for (uint32_t i = 0; i < n; i++)
+		for (uint32_t j = 0; j < n; j++)
+			if (input.at(position1 + orientation1.apply(i, j, n)) != input.at(position2 + orientation2.apply(i, j, n)))
+				return false;
+	return true;
+}
+
+static IndexedImage toPattern(const IndexedInput& input, uint32_t n, vec2 position, const Orientation& orientation) {
+	IndexedImage pattern(n, n, input.palette);
+	for (uint32_t i = 0; i < n; i++)
+		for (uint32_t j = 0; j < n; j++)
+			pattern.set(i, j, input.at(position + orientation.apply(i, j, n)) - 1);
+	return pattern;
+}
+
+ExtractedPatterns ExtractPatterns(const Image& input, uint32_t pattern_size, uint32_t symmetry, bool periodic_input) {
+	if (symmetry < 1 || symmetry > 8)
+		throw invalid_argument("Symmetry must be between 1 and 8");
+	uint32_t n = pattern_size;
+	uint32_t count_i = periodic_input ? input.getHeight() : input.getHeight() - n + 1;
+	uint32_t count_j = periodic_input ? input.getWidth() : input.getWidth() - n + 1;
+	IndexedInput indexed = indexInput(input, count_i + n - 1, count_j + n - 1);
+
+	// The first 1, 2 or 8 symmetries form a group, every window in the same orbit contributes the
+	// same patterns, so only the canonical orientation is looked up and the orbit is expanded at the end
+	// Otherwise each symmetry of the window is looked up on its own
+	bool is_group = symmetry == 1 || symmetry == 2 || symmetry == 8;
+	uint32_t seeds = is_group ? 1 : symmetry;
+	uint32_t group = is_group ? symmetry : 1;
+
+	vector<vector<uint64_t>> hashes(seeds * group);
+	for (uint32_t s = 0; s < seeds; s++)
+		for (uint32_t g = 0; g < group; g++)
+			hashes[s * group + g] =
+				windowHashes(indexed, count_i, count_j, n, ORIENTATIONS[s].compose(ORIENTATIONS[g]));
+
+	size_t capacity = 1;
+	while (capacity < 2 * static_cast<size_t>(count_i) * count_j * seeds)
+		capacity <<= 1;
+	vector<uint64_t> slot_hashes(capacity);
+	vector<uint32_t> slot_classes(capacity, EMPTY_SLOT);
+	vector<PatternClass> classes;
+
+	for (uint32_t i = 0; i < count_i; i++) {
+		for (uint32_t j = 0; j < count_j; j++) {
+			vec2 position(i, j);
+			for (uint32_t s = 0; s < seeds; s++) {
+				uint32_t canonical_g = 0;
+				uint64_t canonical_hash = mix(hashes[s * group][i * count_j + j]);
+				for (uint32_t g = 1; g < group; g++) {
+					uint64_t hash = mix(hashes[s * group + g][i * count_j + j]);
+					if (hash < canonical_hash) {
+						canonical_hash = hash;
+						canonical_g = g;
+					}
+				}
+				Orientation canonical = ORIENTATIONS[s].compose(ORIENTATIONS[canonical_g]);
+
+				size_t slot = canonical_hash & (capacity - 1);
+				while (true) {
+					uint32_t c = slot_classes[slot];
+					if (c == EMPTY_SLOT) {
+						slot_hashes[slot] = canonical_hash;
+						slot_classes[slot] = classes.size();
+						classes.push_back({position, s, canonical, 1});
+						break;
+					}
+					if (slot_hashes[slot] == canonical_hash) {
+						const PatternClass& other = classes[c];
+						// Equal hashes of different orientations may pick different canonical forms
+						bool same = samePattern(indexed, n, position, canonical, other.position, other.canonical);
+						for (uint32_t g = 0; g < group && !same; g++)
+							same = samePattern(indexed, n, position, ORIENTATIONS[s].compose(ORIENTATIONS[g]),
+											   other.position, other.canonical);
+						if (same) {
+							classes[c].count++;
+							break;
+						}
+					}
+					slot = (slot + 1) & (capacity - 1);
+				}
+			}
+		}
+	}
+
+	ExtractedPatterns result;
+	result.palette = indexed.palette;
+	vector<Orientation> expanded;
+	for (vector<PatternClass>::const_iterator it = classes.begin(); it != classes.end(); it++) {
+		uint32_t first = result.patterns.size();
+		expanded.clear();
+		for (uint32_t g = 0; g < group; g++) {
+			Orientation orientation = ORIENTATIONS[it->seed].compose(ORIENTATIONS[g]);
+			uint32_t k = 0;
+			while (k < expanded.size() && !samePattern(indexed, n, it->position, orientation, it->position, expanded[k]))
+				k++;
+			if (k < expanded.size()) {
+				result.weights[first + k] += it->count;
+				continue;
+			}
+			expanded.push_back(orientation);
+			result.patterns.push_back(toPattern(indexed, n, it->position, orientation));
+			result.weights.push_back(it->count);
+		}
+	}
+	return result;
+}
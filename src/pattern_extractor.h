@@ -0,0 +1,37 @@
+#ifndef PATTERN_EXTRACTOR_H
+#define PATTERN_EXTRACTOR_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "image.h"
+
+using namespace std;
+
+// Element of the dihedral group D4 acting on an NxN pattern,
+// maps a pixel of the oriented pattern to the source pixel
+struct Orientation {
+	bool transpose;
+	bool flip_i;
+	bool flip_j;
+	vec2 apply(uint32_t i, uint32_t j, uint32_t size) const;
+	// Orientation equivalent to applying other and then this
+	Orientation compose(const Orientation& other) const;
+};
+
+// Same order as the symmetries generated by mirroring and rotating the input
+inline const Orientation ORIENTATIONS[] = {
+	{false, false, false}, {false, false, true}, {true, false, true}, {true, true, true},
+	{false, true, true},   {false, true, false}, {true, true, false}, {true, false, false},
+};
+
+struct ExtractedPatterns {
+	Palette palette;
+	vector<IndexedImage> patterns; // Unique, in order of appearance
+	vector<double> weights;        // Frequencies
+};
+
+// Extracts every NxN pattern of the input along with its first symmetries
+ExtractedPatterns ExtractPatterns(const Image& input, uint32_t pattern_size, uint32_t symmetry, bool periodic_input);
+
+#endif
@@ -1,54 +1,121 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
 #include "propagator.h"
 
 void Propagator::init() {
-	compatible.fill(0);
 	propagating = stack<Position>();
-	uint32_t patterns_size = state.getSize(1);
-	for (uint32_t dir = 0; dir < DIRECTIONS; dir++)
-		for (uint32_t p = 0; p < patterns_size; p++) {
-			uint32_t count = state(Opposite[dir], p).size();
-			if (count != 0) {
-				for (uint32_t i = 0; i < size.height(); i++)
-					for (uint32_t j = 0; j < size.width(); j++)
-						compatible(dir, p, i, j) = count;
-			}
-		}
+	recounting.clear();
+	size_t cell_size = initial.size();
+	for (size_t cell = 0; cell < topology.cells(); cell++)
+		memcpy(compatible.data() + cell * cell_size, initial.data(), cell_size * sizeof(uint32_t));
 }
 
-Propagator::Propagator(vec2 size, const PropagatorState& state, bool periodic_output)
-	: size(size), periodic_output(periodic_output), state(state),
-	  compatible(DIRECTIONS, state.getSize(1), size.height(), size.width()) {}
+vector<uint32_t> Propagator::counts() const {
+	return vector<uint32_t>(compatible.begin(), compatible.end());
+}
 
-void Propagator::pushPattern(vec2 index, uint32_t pattern) {
-	for (uint32_t dir = 0; dir < DIRECTIONS; dir++)
-		compatible(dir, pattern, index.i, index.j) = 0;
-	propagating.emplace(Position(index, pattern));
+void Propagator::restore(const vector<uint32_t>& counts) {
+	if (counts.size() != compatible.size())
+		throw invalid_argument("Supports of another size");
+	propagating = stack<Position>();
+	recounting.clear();
+	compatible.assign(counts.begin(), counts.end());
 }
 
-void Propagator::propagate(Wave& wave) {
-	while (!propagating.empty()) {
-		Position input = propagating.top();
-		propagating.pop();
-
-		for (uint32_t dir = 0; dir < DIRECTIONS; dir++) {
-			vec2 index;
-			vec2 delta = DIRECTION[dir];
-			if (periodic_output)
-				index = (input.index + delta + wave.size) % wave.size;
-			else {
-				index = input.index + delta;
-				if (!index.inRange(wave.size))
-					continue;
+Propagator::Propagator(const Topology& topology, const PropagatorState& state, Arena* arena)
+	: topology(topology), state(state), directions(state.getSize(0)), pattern_count(state.getSize(1)),
+	  compatible(static_cast<size_t>(topology.cells()) * pattern_count * directions, ArenaAllocator<uint32_t>(arena)),
+	  initial(pattern_count * directions) {
+	if (directions != topology.directions)
+		throw invalid_argument("The model and the topology have different directions");
+	for (uint32_t p = 0; p < pattern_count; p++)
+		for (uint32_t dir = 0; dir < directions; dir++)
+			initial[p * directions + dir] = state(topology.opposite[dir], p).size();
+}
+
+size_t Propagator::arenaSize(const Topology& topology, const PropagatorState& state) {
+	size_t counts = static_cast<size_t>(topology.cells()) * state.getSize(1) * state.getSize(0);
+	return Arena::footprint(counts * sizeof(uint32_t));
+}
+
+void Propagator::pushPattern(uint32_t cell, uint32_t pattern) {
+	for (uint32_t dir = 0; dir < directions; dir++)
+		compatibleCount(cell, pattern, dir) = 0;
+	propagating.emplace(Position(cell, pattern));
+}
+
+void Propagator::pushPatterns(Wave& wave, uint32_t cell, const vector<uint32_t>& patterns) {
+	vector<uint32_t> left;
+	for (uint32_t p = 0; p < pattern_count && left.size() < patterns.size(); p++)
+		if (wave.get(cell, p))
+			left.push_back(p);
+	if (left.size() >= patterns.size()) {
+		for (vector<uint32_t>::const_iterator it = patterns.begin(); it != patterns.end(); it++)
+			pushPattern(cell, *it);
+		return;
+	}
+
+	// Zeroed so the removals propagated back into the cell can't queue these patterns again, the supports of the
+	// neighbors still count them until the next propagation recounts them
+	for (vector<uint32_t>::const_iterator it = patterns.begin(); it != patterns.end(); it++)
+		for (uint32_t dir = 0; dir < directions; dir++)
+			compatibleCount(cell, *it, dir) = 0;
+	recounting.push_back(cell);
+}
+
+// Only exact once every queued removal is propagated, the wave then holds exactly the patterns still counted
+void Propagator::recount(Wave& wave, uint32_t cell) {
+	vector<uint32_t> left;
+	for (uint32_t p = 0; p < pattern_count; p++)
+		if (wave.get(cell, p))
+			left.push_back(p);
+	vector<uint32_t> counts(pattern_count);
+	const Topology::Edge* end = topology.end(cell);
+	for (const Topology::Edge* edge = topology.begin(cell); edge != end; edge++) {
+		fill(counts.begin(), counts.end(), 0);
+		for (vector<uint32_t>::const_iterator it = left.begin(); it != left.end(); it++) {
+			const vector<uint32_t>& allowed = state(edge->direction, *it);
+			for (vector<uint32_t>::const_iterator q = allowed.begin(); q != allowed.end(); q++)
+				counts[*q]++;
+		}
+		for (uint32_t q = 0; q < pattern_count; q++) {
+			if (!wave.get(edge->target, q))
+				continue;
+			compatibleCount(edge->target, q, edge->direction) = counts[q];
+			if (counts[q] == 0) {
+				pushPattern(edge->target, q);
+				wave.set(edge->target, q, false);
 			}
-			const vector<uint32_t>& patterns = state(dir, input.pattern);
-			for (vector<uint32_t>::const_iterator it = patterns.begin(); it != patterns.end(); it++) {
-				uint32_t& value = compatible(dir, *it, index.i, index.j);
-				value--;
-				if (value == 0) {
-					pushPattern(index, *it);
-					wave.set(index, *it, false);
+		}
+	}
+}
+
+void Propagator::propagate(Wave& wave) {
+	while (true) {
+		while (!propagating.empty()) {
+			Position input = propagating.top();
+			propagating.pop();
+
+			const Topology::Edge* end = topology.end(input.cell);
+			for (const Topology::Edge* edge = topology.begin(input.cell); edge != end; edge++) {
+				const vector<uint32_t>& patterns = state(edge->direction, input.pattern);
+				for (vector<uint32_t>::const_iterator it = patterns.begin(); it != patterns.end(); it++) {
+					uint32_t& value = compatibleCount(edge->target, *it, edge->direction);
+					value--;
+					if (value == 0) {
+						pushPattern(edge->target, *it);
+						wave.set(edge->target, *it, false);
+					}
 				}
 			}
 		}
+		if (recounting.empty())
+			return;
+		// One at a time, the removals a recount queues must be propagated before the next one
+		uint32_t cell = recounting.back();
+		recounting.pop_back();
+		recount(wave, cell);
 	}
 }
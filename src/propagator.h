@@ -5,35 +5,50 @@
 #include <stdint.h>
 #include <vector>
 
+#include "arena.h"
 #include "multi_array.h"
+#include "topology.h"
 #include "wave.h"
 
 using namespace std;
 
 class Wave;
 
+// Patterns allowed next to each pattern along each direction of a topology
 typedef Array2D<vector<uint32_t>> PropagatorState;
 
 class Propagator {
 private:
 	struct Position {
-		vec2 index;
+		uint32_t cell;
 		uint32_t pattern;
-		Position(vec2 index, uint32_t pattern) : index(index), pattern(pattern) {}
+		Position(uint32_t cell, uint32_t pattern) : cell(cell), pattern(pattern) {}
 	};
-	const vec2 size;
-	const bool periodic_output;
-	const PropagatorState state;
-	Array4D<uint32_t> compatible;
+	const Topology& topology;     // Owned by the solver
+	const PropagatorState& state; // Owned by the compiled model
+	const uint32_t directions;
+	const uint32_t pattern_count;
+	ArenaVector<uint32_t> compatible; // Per cell, per pattern, per direction, so a pattern's counts share a cache line
+	vector<uint32_t> initial;         // Counts of one cell
 	stack<Position> propagating;
+	vector<uint32_t> recounting; // Cells whose neighbors' supports the next propagation recounts
+	uint32_t& compatibleCount(uint32_t cell, uint32_t pattern, uint32_t dir) {
+		return compatible[(static_cast<size_t>(cell) * pattern_count + pattern) * directions + dir];
+	}
+	void recount(Wave& wave, uint32_t cell);
 public:
-	inline static const uint32_t DIRECTIONS = 4;
-	inline static const vec2 DIRECTION[] = {vec2(-1, 0), vec2(0, -1), vec2(0, 1), vec2(1, 0)};
-	inline static const uint32_t Opposite[] = {3, 2, 1, 0};
-	Propagator(vec2 size, const PropagatorState& state, bool periodic_output);
-	void pushPattern(vec2 index, uint32_t pattern);
+	// The supports are allocated from the arena when there is one
+	Propagator(const Topology& topology, const PropagatorState& state, Arena* arena = nullptr);
+	static size_t arenaSize(const Topology& topology, const PropagatorState& state); // Bytes taken in an arena
+	void pushPattern(uint32_t cell, uint32_t pattern);
+	// Patterns already removed from a cell of the wave together, when fewer patterns are left than removed the
+	// supports of the neighbors are recounted from the patterns left instead of being decremented per removal
+	// Nothing is propagated before the next call to propagate, which recounts after the queued removals
+	void pushPatterns(Wave& wave, uint32_t cell, const vector<uint32_t>& patterns);
 	void propagate(Wave& wave);
 	void init();
+	vector<uint32_t> counts() const; // Supports of every pattern of every cell, once propagated
+	void restore(const vector<uint32_t>& counts);
 };
 
 #endif
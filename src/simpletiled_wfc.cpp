@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <chrono>
 #include <stdexcept>
 
 #include "simpletiled_wfc.h"
+#include "thread_pool.h"
+
+using namespace chrono;
+using hrc = high_resolution_clock;
 
 Tile::Tile(const Image& image, const Symmetry& symmetry, double weight)
 	: images(symmetry.generateOrientations(image)), symmetry(symmetry), weight(weight) {}
@@ -8,25 +14,7 @@ Tile::Tile(const Image& image, const Symmetry& symmetry, double weight)
 Tile::Tile(const vector<Image>& images, const Symmetry& symmetry, double weight)
 	: images(images), symmetry(symmetry), weight(weight) {}
 
-static Array2D<uint32_t> generateActionMap(const Symmetry& symmetry) {
-	uint32_t orientations = symmetry.orientations();
-	vector<uint32_t> rotation_map = symmetry.rotationMap();
-	vector<uint32_t> reflection_map = symmetry.reflectionMap();
-
-	Array2D<uint32_t> action_map(8, orientations);
-	for (uint32_t i = 0; i < 8; i++)
-		for (uint32_t j = 0; j < orientations; j++)
-			if (i == 0)
-				action_map(0, j) = j;
-			else if (i == 4)
-				action_map(4, j) = reflection_map[action_map(0, j)];
-			else
-				action_map(i, j) = rotation_map[action_map(i - 1, j)];
-
-	return action_map;
-}
-
-vector<PatternIndex> SimpletiledWFC::generatePatterns() {
+static vector<PatternIndex> generatePatterns(const vector<Tile>& tiles) {
 	vector<PatternIndex> patterns;
 	patterns.reserve(8 * tiles.size());
 	for (uint32_t i = 0; i < tiles.size(); i++) {
@@ -37,13 +25,12 @@ vector<PatternIndex> SimpletiledWFC::generatePatterns() {
 	return patterns;
 }
 
-vector<vector<uint32_t>> SimpletiledWFC::generatePatternIndices() {
+static vector<vector<uint32_t>> generatePatternIndices(const vector<uint32_t>& orientations) {
 	vector<vector<uint32_t>> pattern_indices;
-	pattern_indices.resize(tiles.size());
+	pattern_indices.resize(orientations.size());
 	uint32_t linear_index = 0;
-	for (uint32_t i = 0; i < tiles.size(); i++) {
-		uint32_t orientations = tiles[i].images.size();
-		for (uint32_t j = 0; j < orientations; j++) {
+	for (uint32_t i = 0; i < orientations.size(); i++) {
+		for (uint32_t j = 0; j < orientations[i]; j++) {
 			pattern_indices[i].push_back(linear_index);
 			linear_index++;
 		}
@@ -51,7 +38,7 @@ vector<vector<uint32_t>> SimpletiledWFC::generatePatternIndices() {
 	return pattern_indices;
 }
 
-vector<double> SimpletiledWFC::computeWeights() const {
+static vector<double> computeWeights(const vector<Tile>& tiles) {
 	vector<double> weights;
 	weights.reserve(8 * tiles.size());
 	for (uint32_t i = 0; i < tiles.size(); i++) {
@@ -62,39 +49,22 @@ vector<double> SimpletiledWFC::computeWeights() const {
 	return weights;
 }
 
-Image SimpletiledWFC::toImage(const Array2D<uint32_t>& output_patterns) const {
-	uint32_t height = output_patterns.getSize(0);
-	uint32_t width = output_patterns.getSize(1);
-	uint32_t size = tiles[0].images[0].getHeight();
-	Image output(height * size, width * size);
-	for (uint32_t i = 0; i < height; i++) {
-		for (uint32_t j = 0; j < width; j++) {
-			const PatternIndex& pattern = patterns[output_patterns(i, j)];
-			for (uint32_t dy = 0; dy < size; dy++)
-				for (uint32_t dx = 0; dx < size; dx++)
-					output(i * size + dy, j * size + dx) =
-						tiles[pattern.tile_index].images[pattern.image_index](dy, dx);
-		}
-	}
-	return output;
-}
-
-PropagatorState SimpletiledWFC::generatePropagator(const vector<NeighborIndex>& neighbors) const {
-	uint32_t pattern_count = patterns.size();
-	Array3D<uint8_t> dense_propagator(Propagator::DIRECTIONS, pattern_count, pattern_count);
-	dense_propagator.fill(false);
+// Adjacencies are appended to the sparse lists directly, then sorted and deduplicated
+static PropagatorState generatePropagator(const vector<Tile>& tiles, const vector<vector<uint32_t>>& pattern_indices,
+										  uint32_t pattern_count, const vector<NeighborIndex>& neighbors) {
+	PropagatorState propagator(Topology::DIRECTIONS, pattern_count);
 
 	for (vector<NeighborIndex>::const_iterator it = neighbors.begin(); it != neighbors.end(); it++) {
-		Array2D<uint32_t> action_map1 = generateActionMap(tiles[it->left_index].symmetry);
-		Array2D<uint32_t> action_map2 = generateActionMap(tiles[it->right_index].symmetry);
+		const Symmetry& symmetry1 = tiles[it->left_index].symmetry;
+		const Symmetry& symmetry2 = tiles[it->right_index].symmetry;
+		if (it->left_orientation >= symmetry1.orientations() || it->right_orientation >= symmetry2.orientations())
+			throw out_of_range("Neighbor orientation out of range");
 
 		auto add = [&](uint32_t action, uint32_t dir) {
-			uint32_t orientation1 = action_map1(action, it->left_orientation);
-			uint32_t orientation2 = action_map2(action, it->right_orientation);
-			uint32_t tile_index1 = pattern_indices[it->left_index][orientation1];
-			uint32_t tile_index2 = pattern_indices[it->right_index][orientation2];
-			dense_propagator(dir, tile_index1, tile_index2) = true;
-			dense_propagator(Propagator::Opposite[dir], tile_index2, tile_index1) = true;
+			uint32_t tile_index1 = pattern_indices[it->left_index][symmetry1.action(action, it->left_orientation)];
+			uint32_t tile_index2 = pattern_indices[it->right_index][symmetry2.action(action, it->right_orientation)];
+			propagator(dir, tile_index1).push_back(tile_index2);
+			propagator(Topology::Opposite[dir], tile_index2).push_back(tile_index1);
 		};
 
 		add(0, 2);
@@ -107,55 +77,89 @@ PropagatorState SimpletiledWFC::generatePropagator(const vector<NeighborIndex>&
 		add(7, 0);
 	}
 
-	PropagatorState propagator(Propagator::DIRECTIONS, pattern_count);
-	for (uint32_t dir = 0; dir < Propagator::DIRECTIONS; dir++)
-		for (uint32_t i = 0; i < pattern_count; i++)
-			for (uint32_t j = 0; j < pattern_count; j++)
-				if (dense_propagator(dir, i, j))
-					propagator(dir, i).push_back(j);
+	ThreadPool::global().parallelFor(Topology::DIRECTIONS * pattern_count, [&](size_t task) {
+		vector<uint32_t>& list = propagator(task / pattern_count, task % pattern_count);
+		sort(list.begin(), list.end());
+		list.erase(unique(list.begin(), list.end()), list.end());
+		list.shrink_to_fit();
+	});
 
 	return propagator;
 }
 
+CompiledModel SimpletiledWFC::compile(const vector<Tile>& tiles, const vector<NeighborIndex>& neighbors) {
+	vector<PatternIndex> patterns = generatePatterns(tiles);
+	vector<uint32_t> orientations;
+	for (uint32_t i = 0; i < tiles.size(); i++)
+		orientations.push_back(tiles[i].images.size());
+	vector<vector<uint32_t>> pattern_indices = generatePatternIndices(orientations);
+
+	vector<Image> images;
+	images.reserve(patterns.size());
+	for (vector<PatternIndex>::const_iterator it = patterns.begin(); it != patterns.end(); it++)
+		images.push_back(tiles[it->tile_index].images[it->image_index]);
+
+	CompiledModel model(images, generatePropagator(tiles, pattern_indices, patterns.size(), neighbors));
+	model.orientations = orientations;
+	model.setWeights(computeWeights(tiles));
+	return model;
+}
+
+SimpletiledWFC::SimpletiledWFC(vec2 size, shared_ptr<const CompiledModel> model, shared_ptr<const TileAtlas> atlas,
+							   const WFCOptions& options)
+	: atlas(atlas), options(options), pattern_indices(generatePatternIndices(model->orientations)),
+	  wfc(size, model, options.periodic_output, options.memory), render_time(0) {}
+
 SimpletiledWFC::SimpletiledWFC(vec2 size, const vector<Tile>& tiles, const vector<NeighborIndex>& neighbors,
 							   const WFCOptions& options)
-	: tiles(tiles), options(options), patterns(generatePatterns()), pattern_indices(generatePatternIndices()),
-	  wfc(size, generatePropagator(neighbors), computeWeights(), options.periodic_output) {}
+	: SimpletiledWFC(size, make_shared<const CompiledModel>(compile(tiles, neighbors)), options) {}
+
+SimpletiledWFC::SimpletiledWFC(vec2 size, shared_ptr<const CompiledModel> model, const WFCOptions& options)
+	: SimpletiledWFC(size, model, make_shared<const TileAtlas>(model->images), options) {}
 
 void SimpletiledWFC::setTile(vec2 index, uint32_t pattern, uint32_t orientation) {
 	if (pattern >= pattern_indices.size() || orientation >= pattern_indices[pattern].size())
 		throw out_of_range("Tile index or orientation out of range");
-	uint32_t pattern_index = pattern_indices[pattern][orientation];
-	for (uint32_t p = 0; p < patterns.size(); p++)
-		if (pattern_index != p)
-			wfc.collapse(index, p);
+	vector<uint8_t> allowed(atlas->size(), false);
+	allowed[pattern_indices[pattern][orientation]] = true;
+	wfc.constrain(vec3(index), vec3(1, 1, 1), allowed);
 }
 
-optional<Image> SimpletiledWFC::execute(int seed) {
+shared_ptr<const WFCState> SimpletiledWFC::setConstraints(const Array2D<uint8_t>& allowed) {
+	return wfc.setInitialConstraints(allowed);
+}
+
+void SimpletiledWFC::setConstraints(shared_ptr<const WFCState> state) {
+	wfc.setInitialState(state);
+}
+
+optional<Array2D<uint32_t>> SimpletiledWFC::solve(int seed) {
 	wfc.init();
-	optional<Array2D<uint32_t>> result = wfc.execute(seed);
-	if (result.has_value())
-		return toImage(result.value());
-	return nullopt;
+	return wfc.execute(seed);
 }
 
-// TODO: Add save / load wfc state
-/*
-if (name == "Summer") {
-	for (uint32_t i = 0; i < height; i++) {
-		wfc.setTile(vec2(i, 0), tile_indices["water_a"], 0);
-		wfc.setTile(vec2(i, width - 1), tile_indices["water_a"], 0);
-	}
-	for (uint32_t j = 0; j < width; j++) {
-		wfc.setTile(vec2(0, j), tile_indices["water_a"], 0);
-		wfc.setTile(vec2(height - 1, j), tile_indices["water_a"], 0);
-	}
-	wfc.setTile(vec2(height / 2, width / 2), tile_indices["grass"], 0);
+Image SimpletiledWFC::render(const Array2D<uint32_t>& output_patterns) const {
+	return atlas->render(output_patterns);
+}
+
+optional<Image> SimpletiledWFC::execute(int seed) {
+	optional<Array2D<uint32_t>> result = solve(seed);
+	if (!result.has_value())
+		return nullopt;
+	hrc::time_point start = hrc::now();
+	Image output = render(result.value());
+	render_time += duration<double>(hrc::now() - start).count();
+	return output;
+}
+
+void SimpletiledWFC::captureFrames(uint32_t interval, uint32_t delay_ms) {
+	wfc.captureFrames(interval, delay_ms);
+}
+
+void SimpletiledWFC::saveAnimation(const string& path) {
+	wfc.saveAnimation(path);
 }
-wfc.save();
 
-::execute() {
-	wfc = WFC(saved_state);
-	wfc.execute();
+double SimpletiledWFC::renderTime() const {
+	return render_time;
 }
-*/
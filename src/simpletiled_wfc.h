@@ -1,13 +1,16 @@
 #ifndef SIMPLETILED_WFC_H
 #define SIMPLETILED_WFC_H
 
+#include <memory>
 #include <optional>
 #include <stdint.h>
 #include <vector>
 
+#include "compiled_model.h"
 #include "image.h"
 #include "multi_array.h"
 #include "symmetry.h"
+#include "tile_atlas.h"
 #include "wfc.h"
 
 using namespace std;
@@ -34,21 +37,31 @@ struct NeighborIndex {
 
 class SimpletiledWFC {
 private:
-	const vector<Tile> tiles;
+	const shared_ptr<const TileAtlas> atlas; // Shared by every solver of the model
 	const WFCOptions options;
-	const vector<PatternIndex> patterns;
 	const vector<vector<uint32_t>> pattern_indices;
 	WFC wfc;
-	vector<PatternIndex> generatePatterns();
-	vector<vector<uint32_t>> generatePatternIndices();
-	vector<double> computeWeights() const;
-	Image toImage(const Array2D<uint32_t>& output_patterns) const;
-	PropagatorState generatePropagator(const vector<NeighborIndex>& neighbors) const;
+	double render_time;
+	// With an atlas of its own, for solvers that don't share their model
+	SimpletiledWFC(vec2 size, shared_ptr<const CompiledModel> model, const WFCOptions& options);
 public:
+	// Only depends on the tiles and their neighbors
+	static CompiledModel compile(const vector<Tile>& tiles, const vector<NeighborIndex>& neighbors);
+	SimpletiledWFC(vec2 size, shared_ptr<const CompiledModel> model, shared_ptr<const TileAtlas> atlas,
+				   const WFCOptions& options);
 	SimpletiledWFC(vec2 size, const vector<Tile>& tiles, const vector<NeighborIndex>& neighbors,
 				   const WFCOptions& options);
 	void setTile(vec2 index, uint32_t pattern, uint32_t orientation);
+	// Every following solve starts from the cells restricted to a mask of one byte per pattern each,
+	// the propagated state is returned for solvers of the same size to share
+	shared_ptr<const WFCState> setConstraints(const Array2D<uint8_t>& allowed);
+	void setConstraints(shared_ptr<const WFCState> state);
+	optional<Array2D<uint32_t>> solve(int seed); // Pattern of every cell
+	Image render(const Array2D<uint32_t>& output_patterns) const;
 	optional<Image> execute(int seed);
+	void captureFrames(uint32_t interval, uint32_t delay_ms);
+	void saveAnimation(const string& path);
+	double renderTime() const; // Seconds spent rendering the outputs
 };
 
 #endif
@@ -40,38 +40,50 @@ uint32_t Symmetry::orientations() const {
 	}
 }
 
-vector<uint32_t> Symmetry::rotationMap() const {
-	switch (value) {
-	case X:
-		return {0};
-	case I:
-	case backslash:
-		return {1, 0};
-	case T:
-	case L:
-		return {1, 2, 3, 0};
-	case F:
-	default:
-		return {1, 2, 3, 0, 5, 6, 7, 4};
+struct OrientationMaps {
+	uint8_t rotation[8];
+	uint8_t reflection[8];
+};
+
+// Indexed by Symmetry::Value
+static constexpr OrientationMaps ORIENTATION_MAPS[] = {
+	{{0}, {0}},
+	{{1, 2, 3, 0}, {0, 3, 2, 1}},
+	{{1, 0}, {0, 1}},
+	{{1, 2, 3, 0}, {1, 0, 3, 2}},
+	{{1, 0}, {1, 0}},
+	{{1, 2, 3, 0, 5, 6, 7, 4}, {4, 7, 6, 5, 0, 3, 2, 1}},
+};
+
+struct ActionMap {
+	uint8_t orientation[8][8]; // [action][orientation]
+};
+
+// Actions 0 to 3 rotate, 4 reflects and 5 to 7 reflect then rotate
+static constexpr ActionMap generateActionMap(const OrientationMaps& maps) {
+	ActionMap map{};
+	for (uint32_t j = 0; j < 8; j++) {
+		map.orientation[0][j] = j;
+		map.orientation[4][j] = maps.reflection[j];
 	}
+	for (uint32_t i = 1; i < 8; i++)
+		if (i != 4)
+			for (uint32_t j = 0; j < 8; j++)
+				map.orientation[i][j] = maps.rotation[map.orientation[i - 1][j]];
+	return map;
 }
 
-vector<uint32_t> Symmetry::reflectionMap() const {
-	switch (value) {
-	case X:
-		return {0};
-	case I:
-		return {0, 1};
-	case backslash:
-		return {1, 0};
-	case T:
-		return {0, 3, 2, 1};
-	case L:
-		return {1, 0, 3, 2};
-	case F:
-	default:
-		return {4, 7, 6, 5, 0, 3, 2, 1};
-	}
+static constexpr ActionMap ACTION_MAPS[] = {
+	generateActionMap(ORIENTATION_MAPS[Symmetry::X]), generateActionMap(ORIENTATION_MAPS[Symmetry::T]),
+	generateActionMap(ORIENTATION_MAPS[Symmetry::I]), generateActionMap(ORIENTATION_MAPS[Symmetry::L]),
+	generateActionMap(ORIENTATION_MAPS[Symmetry::backslash]), generateActionMap(ORIENTATION_MAPS[Symmetry::F]),
+};
+
+static_assert(ACTION_MAPS[Symmetry::F].orientation[5][0] == 5 && ACTION_MAPS[Symmetry::T].orientation[4][1] == 3,
+			  "Unexpected action map");
+
+uint32_t Symmetry::action(uint32_t action, uint32_t orientation) const {
+	return ACTION_MAPS[value].orientation[action][orientation];
 }
 
 vector<Image> Symmetry::generateOrientations(const Image& input) const {
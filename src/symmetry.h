@@ -13,8 +13,8 @@ public:
 	enum Value : char { X, T, I, L, backslash, F };
 	Symmetry(char type);
 	uint32_t orientations() const;
-	vector<uint32_t> rotationMap() const;
-	vector<uint32_t> reflectionMap() const;
+	// Orientation reached from an orientation by an action, 0 to 3 rotate and 4 to 7 reflect then rotate
+	uint32_t action(uint32_t action, uint32_t orientation) const;
 	vector<Image> generateOrientations(const Image& input) const;
 private:
 	Value value;
@@ -0,0 +1,101 @@
+#include "thread_pool.h"
+
+ThreadPool::Job::Job(size_t count, size_t chunk, const function<void(size_t)>& body)
+	: count(count), chunk(chunk), body(body), next(0), finished(0) {}
+
+bool ThreadPool::Job::run() {
+	size_t begin = next.fetch_add(chunk);
+	if (begin >= count)
+		return false;
+	size_t end = min(begin + chunk, count);
+	try {
+		for (size_t i = begin; i < end; i++)
+			body(i);
+	} catch (...) {
+		lock_guard<mutex> lock(error_mutex);
+		if (!error)
+			error = current_exception();
+	}
+	finished.fetch_add(end - begin);
+	return true;
+}
+
+void ThreadPool::work() {
+	while (true) {
+		shared_ptr<Job> job;
+		{
+			unique_lock<mutex> lock(queue_mutex);
+			queue_changed.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+			job = jobs.front();
+		}
+		bool ran = false;
+		while (job->run())
+			ran = true;
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			if (!jobs.empty() && jobs.front() == job)
+				jobs.pop_front();
+		}
+		if (ran)
+			job_finished.notify_all();
+	}
+}
+
+ThreadPool::ThreadPool(uint32_t threads) : stopping(false) {
+	// The thread calling parallelFor also works, so one less worker is needed
+	for (uint32_t i = 1; i < threads; i++)
+		workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(queue_mutex);
+		stopping = true;
+	}
+	queue_changed.notify_all();
+	for (vector<thread>::iterator it = workers.begin(); it != workers.end(); it++)
+		it->join();
+}
+
+uint32_t ThreadPool::size() const {
+	return workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t count, const function<void(size_t)>& body) {
+	// Several chunks per thread to balance uneven iterations
+	parallelFor(count, max<size_t>(1, count / (8 * size())), body);
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunk, const function<void(size_t)>& body) {
+	if (count == 0)
+		return;
+	chunk = max<size_t>(1, chunk);
+	shared_ptr<Job> job = make_shared<Job>(count, chunk, body);
+	if (!workers.empty() && count > chunk) {
+		{
+			lock_guard<mutex> lock(queue_mutex);
+			jobs.push_back(job);
+		}
+		queue_changed.notify_all();
+	}
+	while (job->run())
+		;
+	{
+		unique_lock<mutex> lock(queue_mutex);
+		job_finished.wait(lock, [&job] { return job->finished.load() == job->count; });
+		for (deque<shared_ptr<Job>>::iterator it = jobs.begin(); it != jobs.end(); it++)
+			if (*it == job) {
+				jobs.erase(it);
+				break;
+			}
+	}
+	if (job->error)
+		rethrow_exception(job->error);
+}
+
+ThreadPool& ThreadPool::global() {
+	static ThreadPool pool(max(1u, thread::hardware_concurrency()));
+	return pool;
+}
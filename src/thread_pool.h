@@ -0,0 +1,48 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool {
+private:
+	struct Job {
+		size_t count;
+		size_t chunk;
+		function<void(size_t)> body;
+		atomic<size_t> next;
+		atomic<size_t> finished;
+		exception_ptr error;
+		mutex error_mutex;
+		Job(size_t count, size_t chunk, const function<void(size_t)>& body);
+		bool run(); // Returns false when there are no indices left
+	};
+	bool stopping;
+	mutex queue_mutex;
+	condition_variable queue_changed;
+	condition_variable job_finished;
+	deque<shared_ptr<Job>> jobs;
+	vector<thread> workers;
+	void work();
+public:
+	ThreadPool(uint32_t threads);
+	~ThreadPool();
+	uint32_t size() const;
+	// Calls body(i) for every i < count, the caller thread takes part so nested calls can't deadlock
+	void parallelFor(size_t count, const function<void(size_t)>& body);
+	// Idle threads take the next chunk indices in increasing order, chunk 1 suits a few long tasks
+	void parallelFor(size_t count, size_t chunk, const function<void(size_t)>& body);
+	static ThreadPool& global();
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include <stdexcept>
+#include <string.h>
+
+#include "tile_atlas.h"
+
+TileAtlas::TileAtlas(const vector<Image>& tiles)
+	: tile_height(tiles.empty() ? 0 : tiles[0].getHeight()), tile_width(tiles.empty() ? 0 : tiles[0].getWidth()) {
+	pixels.reserve(tiles.size() * tile_height * tile_width);
+	for (vector<Image>::const_iterator it = tiles.begin(); it != tiles.end(); it++) {
+		if (it->getHeight() != tile_height || it->getWidth() != tile_width)
+			throw logic_error("Tiles must have the same size");
+		pixels.insert(pixels.end(), it->rawData(), it->rawData() + tile_height * tile_width);
+	}
+}
+
+size_t TileAtlas::size() const {
+	return tile_height * tile_width == 0 ? 0 : pixels.size() / (tile_height * tile_width);
+}
+
+Image TileAtlas::render(const Array2D<uint32_t>& tile_indices) const {
+	size_t height = tile_indices.getSize(0);
+	size_t width = tile_indices.getSize(1);
+	size_t tile_size = tile_height * tile_width;
+	size_t row_length = width * tile_width;
+	Image output(height * tile_height, row_length);
+	RGB* data = output.rawData();
+	for (size_t i = 0; i < height; i++) {
+		for (size_t j = 0; j < width; j++) {
+			uint32_t tile = tile_indices(i, j);
+			if (tile >= size())
+				throw out_of_range("Tile index out of range");
+			const RGB* source = &pixels[tile * tile_size];
+			RGB* target = &data[i * tile_height * row_length + j * tile_width];
+			for (size_t dy = 0; dy < tile_height; dy++)
+				memcpy(target + dy * row_length, source + dy * tile_width, tile_width * sizeof(RGB));
+		}
+	}
+	return output;
+}
@@ -0,0 +1,25 @@
+#ifndef TILE_ATLAS_H
+#define TILE_ATLAS_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "image.h"
+#include "multi_array.h"
+
+using namespace std;
+
+// Tiles laid out one after the other so each tile row is a contiguous run of pixels
+class TileAtlas {
+private:
+	size_t tile_height;
+	size_t tile_width;
+	vector<RGB> pixels;
+public:
+	TileAtlas(const vector<Image>& tiles);
+	size_t size() const;
+	// Copies whole tile rows into a new image, which the encoders read from and filter or index into their own rows
+	Image render(const Array2D<uint32_t>& tile_indices) const;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdexcept>
+
+#include "topology.h"
+
+Topology::Topology(vec3 size, const vector<uint32_t>& opposite, const vector<Link>& links)
+	: offsets(size.volume() + 1, 0), edges(links.size()), size(size), directions(opposite.size()),
+	  opposite(opposite) {
+	for (uint32_t dir = 0; dir < directions; dir++)
+		if (opposite[dir] >= directions || opposite[opposite[dir]] != dir)
+			throw invalid_argument("Opposite directions must be pairs");
+	for (vector<Link>::const_iterator it = links.begin(); it != links.end(); it++) {
+		if (it->source >= cells() || it->target >= cells() || it->direction >= directions)
+			throw invalid_argument("Edge out of range");
+		offsets[it->source + 1]++;
+	}
+	for (uint32_t cell = 0; cell < cells(); cell++)
+		offsets[cell + 1] += offsets[cell];
+	// Counting sort by source, stable so the edges of a cell keep their order
+	vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+	for (vector<Link>::const_iterator it = links.begin(); it != links.end(); it++)
+		edges[next[it->source]++] = {it->target, it->direction};
+}
+
+Topology Topology::grid(vec3 size, uint32_t directions, bool periodic) {
+	if (directions != DIRECTIONS && directions != VOXEL_DIRECTIONS)
+		throw invalid_argument("Grids have 4 or 6 directions");
+	vector<Link> links;
+	links.reserve(static_cast<size_t>(size.volume()) * directions);
+	for (uint32_t cell = 0; cell < size.volume(); cell++) {
+		vec3 index = vec3::unflatten(cell, size);
+		for (uint32_t dir = 0; dir < directions; dir++) {
+			vec3 neighbor = index + DIRECTION[dir];
+			if (periodic)
+				neighbor = (neighbor + size) % size;
+			else if (!neighbor.inRange(size))
+				continue;
+			links.push_back({cell, neighbor.flatten(size), dir});
+		}
+	}
+	return Topology(size, vector<uint32_t>(Opposite, Opposite + directions), links);
+}
+
+Topology Topology::hex(vec2 size, bool periodic) {
+	if (periodic && size.height() % 2 != 0)
+		throw invalid_argument("Periodic hex grids need an even number of rows");
+	// Column offsets of the rows above and below, for even and odd rows
+	const int ROW_OFFSET[2][2] = {{-1, 0}, {0, 1}};
+	vector<Link> links;
+	links.reserve(static_cast<size_t>(size.height()) * size.width() * VOXEL_DIRECTIONS);
+	for (int i = 0; i < size.i; i++)
+		for (int j = 0; j < size.j; j++) {
+			const int* offset = ROW_OFFSET[i % 2];
+			vec2 deltas[] = {vec2(-1, offset[0]), vec2(0, -1), vec2(0, 1),
+							 vec2(1, offset[1]),  vec2(-1, offset[1]), vec2(1, offset[0])};
+			for (uint32_t dir = 0; dir < VOXEL_DIRECTIONS; dir++) {
+				vec2 neighbor = vec2(i, j) + deltas[dir];
+				if (periodic)
+					neighbor = (neighbor + size) % size;
+				else if (!neighbor.inRange(size))
+					continue;
+				uint32_t cell = i * size.width() + j;
+				links.push_back({cell, neighbor.i * size.width() + neighbor.j, dir});
+			}
+		}
+	return Topology(vec3(size.i, size.j, 1), vector<uint32_t>(Opposite, Opposite + VOXEL_DIRECTIONS), links);
+}
+
+uint32_t Topology::cells() const {
+	return size.volume();
+}
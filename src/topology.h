@@ -0,0 +1,54 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "multi_array.h"
+
+using namespace std;
+
+// Cells and the directed edges between them, each labelled with the direction it goes along
+// Edges are stored in CSR form, those of a cell are contiguous and in the order they were given
+class Topology {
+public:
+	struct Edge {
+		uint32_t target;
+		uint32_t direction;
+	};
+	struct Link {
+		uint32_t source;
+		uint32_t target;
+		uint32_t direction;
+	};
+private:
+	vector<uint32_t> offsets; // Edges of cell c are [offsets[c], offsets[c + 1])
+	vector<Edge> edges;
+public:
+	// Directions of grids, within a layer then down and up a layer
+	inline static const uint32_t DIRECTIONS = 4;
+	inline static const uint32_t VOXEL_DIRECTIONS = 6;
+	inline static const vec3 DIRECTION[] = {vec3(-1, 0, 0), vec3(0, -1, 0), vec3(0, 1, 0),
+											vec3(1, 0, 0),  vec3(0, 0, -1), vec3(0, 0, 1)};
+	inline static const uint32_t Opposite[] = {3, 2, 1, 0, 5, 4};
+
+	const vec3 size; // Layout of the cells, given as cells x 1 x 1 for graphs
+	const uint32_t directions;
+	const vector<uint32_t> opposite; // Direction of the edge back
+	// Links can be in any order, there are as many cells as size.volume()
+	Topology(vec3 size, const vector<uint32_t>& opposite, const vector<Link>& links);
+	// Cells of a grid with the first directions of DIRECTION
+	static Topology grid(vec3 size, uint32_t directions, bool periodic);
+	// Rows of hexagons, odd rows shifted right by half a cell, with the 6 directions
+	// up-left, left, right, down-right, up-right and down-left, paired as opposites like those of grids
+	static Topology hex(vec2 size, bool periodic);
+	uint32_t cells() const;
+	const Edge* begin(uint32_t cell) const {
+		return edges.data() + offsets[cell];
+	}
+	const Edge* end(uint32_t cell) const {
+		return edges.data() + offsets[cell + 1];
+	}
+};
+
+#endif
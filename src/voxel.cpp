@@ -0,0 +1,252 @@
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+
+#include "voxel.h"
+
+static const uint32_t VOX_VERSION = 150;
+static const size_t VOX_MAX_SIZE = 256;
+
+VoxelModel::VoxelModel(size_t size_x, size_t size_y, size_t size_z) : Array3D<uint8_t>(size_z, size_y, size_x) {}
+
+size_t VoxelModel::sizeX() const {
+	return size[2];
+}
+
+size_t VoxelModel::sizeY() const {
+	return size[1];
+}
+
+size_t VoxelModel::sizeZ() const {
+	return size[0];
+}
+
+uint8_t* VoxelModel::rawData() {
+	return data.data();
+}
+
+const uint8_t* VoxelModel::rawData() const {
+	return data.data();
+}
+
+VoxelFormat ParseVoxelFormat(const string& name) {
+	if (name == "vox")
+		return VoxelFormat::VOX;
+	if (name == "raw")
+		return VoxelFormat::RAW;
+	throw invalid_argument("Unknown voxel format: " + name);
+}
+
+const char* VoxelFormatExtension(VoxelFormat format) {
+	switch (format) {
+	case VoxelFormat::RAW:
+		return "rgba";
+	case VoxelFormat::VOX:
+	default:
+		return "vox";
+	}
+}
+
+// Palette of files without an RGBA chunk: a 6x6x6 color cube without black, then ramps of red, green, blue and gray
+static vector<RGB> defaultPalette() {
+	vector<RGB> palette;
+	for (int r = 5; r >= 0; r--)
+		for (int g = 5; g >= 0; g--)
+			for (int b = 5; b >= 0; b--)
+				if (r + g + b > 0)
+					palette.push_back({static_cast<uint8_t>(r * 0x33), static_cast<uint8_t>(g * 0x33),
+									   static_cast<uint8_t>(b * 0x33)});
+	const uint8_t RAMP[] = {0xEE, 0xDD, 0xBB, 0xAA, 0x88, 0x77, 0x55, 0x44, 0x22, 0x11};
+	for (uint32_t channel = 0; channel < 4; channel++)
+		for (uint32_t k = 0; k < sizeof(RAMP); k++) {
+			uint8_t value = RAMP[k];
+			palette.push_back({channel == 0 || channel == 3 ? value : uint8_t(0),
+							   channel == 1 || channel == 3 ? value : uint8_t(0),
+							   channel == 2 || channel == 3 ? value : uint8_t(0)});
+		}
+	return palette;
+}
+
+static uint32_t readLittleEndian(const uint8_t* data) {
+	return data[0] | data[1] << 8 | data[2] << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+static void appendLittleEndian(vector<uint8_t>& buffer, uint32_t value) {
+	buffer.push_back(value);
+	buffer.push_back(value >> 8);
+	buffer.push_back(value >> 16);
+	buffer.push_back(value >> 24);
+}
+
+static void appendChunk(vector<uint8_t>& buffer, const char* id, const vector<uint8_t>& content,
+						uint32_t children_size) {
+	buffer.insert(buffer.end(), id, id + 4);
+	appendLittleEndian(buffer, content.size());
+	appendLittleEndian(buffer, children_size);
+	buffer.insert(buffer.end(), content.begin(), content.end());
+}
+
+static vector<uint8_t> readFile(const string& path) {
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr)
+		throw runtime_error("Failed to read voxel model: " + path);
+	vector<uint8_t> buffer;
+	uint8_t block[4096];
+	size_t count;
+	while ((count = fread(block, 1, sizeof(block), file)) > 0)
+		buffer.insert(buffer.end(), block, block + count);
+	fclose(file);
+	return buffer;
+}
+
+VoxelModel LoadVoxelModel(const string& path) {
+	vector<uint8_t> buffer = readFile(path);
+	if (buffer.size() < 8 || memcmp(buffer.data(), "VOX ", 4) != 0)
+		throw runtime_error("Not a .vox file: " + path);
+
+	// Chunks are flattened, the children of MAIN are read as if they followed it
+	const uint8_t* size_chunk = nullptr;
+	const uint8_t* voxels_chunk = nullptr;
+	const uint8_t* palette_chunk = nullptr;
+	size_t position = 8;
+	while (position + 12 <= buffer.size()) {
+		const uint8_t* chunk = buffer.data() + position;
+		uint32_t content_size = readLittleEndian(chunk + 4);
+		position += 12;
+		if (content_size > buffer.size() - position)
+			throw runtime_error("Truncated .vox file: " + path);
+		const uint8_t* content = buffer.data() + position;
+		if (memcmp(chunk, "SIZE", 4) == 0 && size_chunk == nullptr && content_size >= 12)
+			size_chunk = content;
+		else if (memcmp(chunk, "XYZI", 4) == 0 && voxels_chunk == nullptr && content_size >= 4 &&
+				 (content_size - 4) / 4 >= readLittleEndian(content))
+			voxels_chunk = content;
+		else if (memcmp(chunk, "RGBA", 4) == 0 && content_size >= 1024)
+			palette_chunk = content;
+		position += content_size;
+	}
+	if (size_chunk == nullptr || voxels_chunk == nullptr)
+		throw runtime_error("No model in .vox file: " + path);
+
+	// Checked before allocating, the product of unchecked sizes can wrap or ask for gigabytes
+	uint32_t sizes[3] = {readLittleEndian(size_chunk), readLittleEndian(size_chunk + 4), readLittleEndian(size_chunk + 8)};
+	for (uint32_t k = 0; k < 3; k++)
+		if (sizes[k] == 0 || sizes[k] > VOX_MAX_SIZE)
+			throw runtime_error("Invalid model size in " + path);
+	VoxelModel model(sizes[0], sizes[1], sizes[2]);
+	uint32_t count = readLittleEndian(voxels_chunk);
+	for (uint32_t v = 0; v < count; v++) {
+		const uint8_t* voxel = voxels_chunk + 4 + 4 * v;
+		if (voxel[0] >= model.sizeX() || voxel[1] >= model.sizeY() || voxel[2] >= model.sizeZ())
+			throw runtime_error("Voxel out of bounds in " + path);
+		model(voxel[2], voxel[1], voxel[0]) = voxel[3];
+	}
+	if (palette_chunk == nullptr)
+		model.palette = defaultPalette();
+	else
+		for (uint32_t c = 0; c < 255; c++)
+			model.palette.push_back({palette_chunk[4 * c], palette_chunk[4 * c + 1], palette_chunk[4 * c + 2]});
+	return model;
+}
+
+static vector<uint8_t> encodeVox(const VoxelModel& model) {
+	if (model.sizeX() > VOX_MAX_SIZE || model.sizeY() > VOX_MAX_SIZE || model.sizeZ() > VOX_MAX_SIZE)
+		throw invalid_argument("Voxel model too large for a .vox file, use the raw format");
+
+	vector<uint8_t> size;
+	appendLittleEndian(size, model.sizeX());
+	appendLittleEndian(size, model.sizeY());
+	appendLittleEndian(size, model.sizeZ());
+	vector<uint8_t> voxels(4);
+	uint32_t count = 0;
+	for (uint32_t z = 0; z < model.sizeZ(); z++)
+		for (uint32_t y = 0; y < model.sizeY(); y++)
+			for (uint32_t x = 0; x < model.sizeX(); x++)
+				if (model(z, y, x) != 0) {
+					uint8_t voxel[4] = {static_cast<uint8_t>(x), static_cast<uint8_t>(y), static_cast<uint8_t>(z),
+										model(z, y, x)};
+					voxels.insert(voxels.end(), voxel, voxel + 4);
+					count++;
+				}
+	voxels[0] = count;
+	voxels[1] = count >> 8;
+	voxels[2] = count >> 16;
+	voxels[3] = count >> 24;
+	vector<uint8_t> palette(1024, 0);
+	for (uint32_t c = 0; c < model.palette.size() && c < 255; c++) {
+		palette[4 * c] = model.palette[c].r;
+		palette[4 * c + 1] = model.palette[c].g;
+		palette[4 * c + 2] = model.palette[c].b;
+		palette[4 * c + 3] = 255;
+	}
+
+	vector<uint8_t> children;
+	appendChunk(children, "SIZE", size, 0);
+	appendChunk(children, "XYZI", voxels, 0);
+	appendChunk(children, "RGBA", palette, 0);
+	vector<uint8_t> buffer = {'V', 'O', 'X', ' '};
+	appendLittleEndian(buffer, VOX_VERSION);
+	appendChunk(buffer, "MAIN", {}, children.size());
+	buffer.insert(buffer.end(), children.begin(), children.end());
+	return buffer;
+}
+
+static vector<uint8_t> encodeRaw(const VoxelModel& model) {
+	vector<uint8_t> buffer = {'V', 'X', 'L', '8'};
+	appendLittleEndian(buffer, model.sizeX());
+	appendLittleEndian(buffer, model.sizeY());
+	appendLittleEndian(buffer, model.sizeZ());
+	size_t count = model.sizeX() * model.sizeY() * model.sizeZ();
+	buffer.reserve(buffer.size() + 4 * count);
+	for (size_t v = 0; v < count; v++) {
+		uint8_t color = model.rawData()[v];
+		if (color == 0 || color > model.palette.size()) {
+			buffer.insert(buffer.end(), 4, 0);
+			continue;
+		}
+		const RGB& rgb = model.palette[color - 1];
+		uint8_t rgba[4] = {rgb.r, rgb.g, rgb.b, 255};
+		buffer.insert(buffer.end(), rgba, rgba + 4);
+	}
+	return buffer;
+}
+
+void SaveVoxelModel(const string& path, const VoxelModel& model, VoxelFormat format) {
+	vector<uint8_t> buffer = format == VoxelFormat::RAW ? encodeRaw(model) : encodeVox(model);
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == nullptr)
+		throw runtime_error("Failed to write voxel model: " + path);
+	bool success = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	success = fclose(file) == 0 && success;
+	if (!success)
+		throw runtime_error("Failed to write voxel model: " + path);
+}
+
+void SharePalette(vector<VoxelModel>& models) {
+	Palette shared;
+	for (vector<VoxelModel>::iterator it = models.begin(); it != models.end(); it++) {
+		// Colors are added on first use, unused palette entries are dropped
+		vector<uint8_t> remap(256, 0);
+		uint8_t* voxels = it->rawData();
+		size_t count = it->sizeX() * it->sizeY() * it->sizeZ();
+		for (size_t v = 0; v < count; v++) {
+			uint8_t color = voxels[v];
+			if (color == 0)
+				continue;
+			if (remap[color] == 0) {
+				if (color > it->palette.size())
+					throw runtime_error("Voxel color missing from the palette");
+				uint32_t index = shared.add(it->palette[color - 1]);
+				if (index >= 255)
+					throw runtime_error("Voxel models use more than 255 colors");
+				remap[color] = index + 1;
+			}
+			voxels[v] = remap[color];
+		}
+	}
+	vector<RGB> palette;
+	for (uint32_t c = 0; c < shared.size(); c++)
+		palette.push_back(shared[c]);
+	for (vector<VoxelModel>::iterator it = models.begin(); it != models.end(); it++)
+		it->palette = palette;
+}
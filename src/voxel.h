@@ -0,0 +1,39 @@
+#ifndef VOXEL_H
+#define VOXEL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "multi_array.h"
+
+using namespace std;
+
+// Voxels are indexed by z, y and x, z is up as in MagicaVoxel
+// A voxel is 0 when empty and the index of its color in the palette plus one otherwise
+class VoxelModel : public Array3D<uint8_t> {
+public:
+	vector<RGB> palette; // At most 255 colors
+	VoxelModel(size_t size_x, size_t size_y, size_t size_z);
+	size_t sizeX() const;
+	size_t sizeY() const;
+	size_t sizeZ() const;
+	uint8_t* rawData();
+	const uint8_t* rawData() const;
+};
+
+// vox is the MagicaVoxel format, limited to 256 voxels along each axis
+// raw is "VXL8", the little-endian 32-bit x, y and z sizes, then the RGBA of every voxel with x varying
+// fastest, alpha is 0 for empty voxels
+enum class VoxelFormat { VOX, RAW };
+
+VoxelFormat ParseVoxelFormat(const string& name);
+const char* VoxelFormatExtension(VoxelFormat format);
+// Reads the first model of a .vox file
+VoxelModel LoadVoxelModel(const string& path);
+void SaveVoxelModel(const string& path, const VoxelModel& model, VoxelFormat format);
+// Gives every model the same palette of the colors they use
+void SharePalette(vector<VoxelModel>& models);
+
+#endif
@@ -0,0 +1,113 @@
+#include <chrono>
+#include <stdexcept>
+#include <string.h>
+
+#include "voxelmosaic_wfc.h"
+
+using namespace chrono;
+using hrc = high_resolution_clock;
+
+VoxelWeight::VoxelWeight(const VoxelModel& model, double weight) : model(model), weight(weight) {}
+
+static vector<double> computeWeights(const vector<VoxelWeight>& tiles) {
+	vector<double> weights(tiles.size());
+	for (uint32_t i = 0; i < tiles.size(); i++)
+		weights[i] = tiles[i].weight;
+	return weights;
+}
+
+static PropagatorState generatePropagator(uint32_t tile_count, const Array3D<uint8_t>& neighbors) {
+	PropagatorState state(Topology::VOXEL_DIRECTIONS, tile_count);
+	for (uint32_t dir = 0; dir < Topology::VOXEL_DIRECTIONS; dir++)
+		for (uint32_t i = 0; i < tile_count; i++)
+			for (uint32_t j = 0; j < tile_count; j++)
+				if (neighbors(dir, i, j) || neighbors(Topology::Opposite[dir], j, i)) {
+					if (!neighbors(dir, i, j))
+						printf("[Warning] Missing neighbor %d-%d (x=%d, y=%d, z=%d)\n", i, j,
+							   Topology::DIRECTION[dir].j, Topology::DIRECTION[dir].i, Topology::DIRECTION[dir].k);
+					state(dir, i).push_back(j);
+				}
+	return state;
+}
+
+CompiledModel VoxelmosaicWFC::compile(const vector<VoxelWeight>& tiles, const Array3D<uint8_t>& neighbors,
+									  optional<uint32_t> ground) {
+	for (uint32_t i = 1; i < tiles.size(); i++)
+		if (tiles[i].model.sizeX() != tiles[0].model.sizeX() || tiles[i].model.sizeY() != tiles[0].model.sizeY() ||
+			tiles[i].model.sizeZ() != tiles[0].model.sizeZ())
+			throw invalid_argument("Voxel tiles must have the same size");
+	// The voxels are kept by the caller, only the rules are compiled
+	CompiledModel model(vector<Image>(), generatePropagator(tiles.size(), neighbors));
+	model.orientations = vector<uint32_t>(tiles.size(), 1);
+	model.setWeights(computeWeights(tiles));
+	model.ground = ground;
+	return model;
+}
+
+VoxelmosaicWFC::VoxelmosaicWFC(vec3 size, shared_ptr<const CompiledModel> model,
+							   shared_ptr<const vector<VoxelModel>> tiles, const WFCOptions& options)
+	: model(model), tiles(tiles), size(size), wfc(size, model, options.periodic_output, options.memory),
+	  render_time(0) {
+	if (tiles->size() != model->size())
+		throw invalid_argument("Voxel tiles don't match the compiled model");
+}
+
+void VoxelmosaicWFC::initGround() {
+	uint32_t ground = model->ground.value();
+	vector<uint8_t> not_ground(tiles->size(), true);
+	not_ground[ground] = false;
+	for (uint32_t i = 0; i < size.height(); i++)
+		for (uint32_t j = 0; j < size.width(); j++) {
+			setTile(vec3(i, j, 0), ground);
+			wfc.constrain(vec3(i, j, 1), vec3(1, 1, size.depth() - 1), not_ground);
+		}
+	wfc.propagate();
+}
+
+void VoxelmosaicWFC::setTile(vec3 index, uint32_t pattern) {
+	if (pattern >= tiles->size())
+		throw out_of_range("Tile index out of range");
+	vector<uint8_t> allowed(tiles->size(), false);
+	allowed[pattern] = true;
+	wfc.constrain(index, vec3(1, 1, 1), allowed);
+}
+
+optional<Array3D<uint32_t>> VoxelmosaicWFC::solve(int seed) {
+	wfc.init();
+	if (model->ground.has_value())
+		initGround();
+	return wfc.executeVolume(seed);
+}
+
+VoxelModel VoxelmosaicWFC::render(const Array3D<uint32_t>& output_patterns) const {
+	const VoxelModel& first = tiles->at(0);
+	size_t tile_x = first.sizeX();
+	size_t tile_y = first.sizeY();
+	size_t tile_z = first.sizeZ();
+	VoxelModel output(size.width() * tile_x, size.height() * tile_y, size.depth() * tile_z);
+	output.palette = first.palette;
+	// Tile rows along x are contiguous in both the tile and the output
+	for (uint32_t k = 0; k < size.depth(); k++)
+		for (uint32_t i = 0; i < size.height(); i++)
+			for (uint32_t j = 0; j < size.width(); j++) {
+				const VoxelModel& tile = (*tiles)[output_patterns(k, i, j)];
+				for (size_t z = 0; z < tile_z; z++)
+					for (size_t y = 0; y < tile_y; y++)
+						memcpy(&output(k * tile_z + z, i * tile_y + y, j * tile_x), &tile(z, y, 0), tile_x);
+			}
+	return output;
+}
+
+optional<VoxelModel> VoxelmosaicWFC::execute(int seed) {
+	optional<Array3D<uint32_t>> result = solve(seed);
+	if (!result.has_value())
+		return nullopt;
+	hrc::time_point start = hrc::now();
+	VoxelModel output = render(result.value());
+	render_time += duration<double>(hrc::now() - start).count();
+	return output;
+}
+
+double VoxelmosaicWFC::renderTime() const {
+	return render_time;
+}
@@ -0,0 +1,45 @@
+#ifndef VOXELMOSAICWFC_H
+#define VOXELMOSAICWFC_H
+
+#include <memory>
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include "compiled_model.h"
+#include "multi_array.h"
+#include "voxel.h"
+#include "wfc.h"
+
+using namespace std;
+
+struct VoxelWeight {
+	VoxelModel model;
+	double weight;
+	VoxelWeight(const VoxelModel& model, double weight);
+};
+
+// Imagemosaic in 3D, tiles are voxel models of the same size placed along six directions:
+// front, left, right and back within a layer (-y, -x, +x, +y), then down and up (-z, +z)
+class VoxelmosaicWFC {
+private:
+	const shared_ptr<const CompiledModel> model;
+	const shared_ptr<const vector<VoxelModel>> tiles; // Share a palette
+	const vec3 size;                                  // In tiles, k is z
+	WFC wfc;
+	double render_time;
+	void initGround();
+public:
+	// Only depends on the tiles, their neighbors and the ground tile, which fills the bottom layer
+	static CompiledModel compile(const vector<VoxelWeight>& tiles, const Array3D<uint8_t>& neighbors,
+								 optional<uint32_t> ground);
+	VoxelmosaicWFC(vec3 size, shared_ptr<const CompiledModel> model, shared_ptr<const vector<VoxelModel>> tiles,
+				   const WFCOptions& options);
+	void setTile(vec3 index, uint32_t pattern);
+	optional<Array3D<uint32_t>> solve(int seed); // Pattern of every cell
+	VoxelModel render(const Array3D<uint32_t>& output_patterns) const;
+	optional<VoxelModel> execute(int seed);
+	double renderTime() const; // Seconds spent rendering the outputs
+};
+
+#endif
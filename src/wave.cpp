@@ -1,15 +1,73 @@
 #include "wave.h"
 
+#include <algorithm>
 #include <limits>
 #include <math.h>
+#include <stdexcept>
+#include <string.h>
 
-static vector<double> calculate_plogp(const vector<double>& distribution) {
-	vector<double> plogp;
-	for (uint32_t i = 0; i < distribution.size(); i++) {
-		double p = distribution[i];
-		plogp.push_back(p * log(p));
+// Fractional bits of the fixed point logarithms, and bits of the fraction indexing the table
+static const uint32_t LOG_BITS = 24;
+static const uint32_t TABLE_BITS = 12;
+
+struct Log2Table {
+	uint32_t values[(1 << TABLE_BITS) + 1];
+};
+
+// log2(1 + i / 2^TABLE_BITS) by repeated squaring, only integers so the table is the same everywhere
+static constexpr Log2Table makeLog2Table() {
+	Log2Table table{};
+	for (uint64_t i = 0; i < (1 << TABLE_BITS); i++) {
+		uint64_t y = (1ULL << 30) + (i << (30 - TABLE_BITS)); // 30 fractional bits, in [1, 2)
+		uint32_t result = 0;
+		for (uint32_t bit = 0; bit < LOG_BITS; bit++) {
+			y = (y * y) >> 30;
+			result <<= 1;
+			if (y >= (2ULL << 30)) {
+				y >>= 1;
+				result |= 1;
+			}
+		}
+		table.values[i] = result;
+	}
+	table.values[1 << TABLE_BITS] = 1 << LOG_BITS;
+	return table;
+}
+
+static constexpr Log2Table LOG2_TABLE = makeLog2Table();
+
+// log2(x) with LOG_BITS fractional bits, interpolated between the entries of the table
+static int64_t fixedLog2(uint64_t x) {
+	uint32_t exponent = 63 - __builtin_clzll(x);
+	uint64_t fraction = exponent >= 28 ? x >> (exponent - 28) : x << (28 - exponent);
+	fraction &= (1ULL << 28) - 1;
+	uint32_t index = fraction >> (28 - TABLE_BITS);
+	uint64_t low = LOG2_TABLE.values[index];
+	uint64_t high = LOG2_TABLE.values[index + 1];
+	uint64_t remainder = fraction & ((1ULL << (28 - TABLE_BITS)) - 1);
+	return (static_cast<int64_t>(exponent) << LOG_BITS) + low + (((high - low) * remainder) >> (28 - TABLE_BITS));
+}
+
+EntropyMode ParseEntropyMode(const string& name) {
+	if (name == "double")
+		return EntropyMode::DOUBLE;
+	if (name == "float")
+		return EntropyMode::FLOAT;
+	if (name == "fixed")
+		return EntropyMode::FIXED;
+	throw invalid_argument("Unknown entropy mode: " + name);
+}
+
+const char* EntropyModeName(EntropyMode mode) {
+	switch (mode) {
+	case EntropyMode::FLOAT:
+		return "float";
+	case EntropyMode::FIXED:
+		return "fixed";
+	case EntropyMode::DOUBLE:
+	default:
+		return "double";
 	}
-	return plogp;
 }
 
 static double calculate_min_abs_half(const vector<double>& distribution) {
@@ -19,76 +77,342 @@ static double calculate_min_abs_half(const vector<double>& distribution) {
 	return min_abs_half;
 }
 
+static double logOf(double x) {
+	return log(x);
+}
+
+static float logOf(float x) {
+	return logf(x);
+}
+
+template <typename Real>
+static void updateEntropy(BasicProbability<Real>& probability) {
+	probability.sum_log = logOf(probability.sum);
+	probability.entropy = probability.sum_log - probability.sum_plogp / probability.sum;
+}
+
+static void updateEntropy(FixedProbability& probability) {
+	probability.entropy = probability.sum == 0 ? 0
+											   : fixedLog2(probability.sum) -
+													 probability.sum_plogp / static_cast<int64_t>(probability.sum);
+}
+
+template <typename P, typename W, typename L>
+static P initialProbability(const vector<W>& weights, const vector<L>& plogp) {
+	P probability{};
+	for (uint32_t i = 0; i < weights.size(); i++) {
+		probability.sum += weights[i];
+		probability.sum_plogp += plogp[i];
+	}
+	probability.remaining = weights.size();
+	updateEntropy(probability);
+	return probability;
+}
+
+// Subtracted in the order of the patterns, as successive calls to set would
+template <typename P, typename W, typename L>
+static uint32_t removePatterns(P& probability, const vector<W>& weights, const vector<L>& plogp,
+							   const uint32_t* patterns, size_t count) {
+	for (size_t k = 0; k < count; k++) {
+		probability.sum -= weights[patterns[k]];
+		probability.sum_plogp -= plogp[patterns[k]];
+	}
+	probability.remaining -= count;
+	updateEntropy(probability);
+	return probability.remaining;
+}
+
+template <typename P, typename Noise>
+static ObserveStatus findMinEntropy(const ArenaVector<P>& probabilities, Noise noise, uint32_t& argmin) {
+	typedef decltype(P::entropy) Entropy;
+	bool all_collapsed = true;
+	Entropy min = numeric_limits<Entropy>::has_infinity ? numeric_limits<Entropy>::infinity()
+														: numeric_limits<Entropy>::max();
+
+	for (uint32_t cell = 0; cell < probabilities.size(); cell++) {
+		if (probabilities[cell].remaining == 1)
+			continue;
+
+		Entropy entropy = probabilities[cell].entropy;
+		if (entropy <= min) {
+			Entropy cell_noise = noise();
+			if (entropy + cell_noise < min) {
+				min = entropy + cell_noise;
+				all_collapsed = false;
+				argmin = cell;
+			}
+		}
+	}
+	return all_collapsed ? ObserveStatus::SUCCESS : ObserveStatus::CONTINUE;
+}
+
+// Uniform in [0, range) from the 31 bits of the generator, the same on every platform
+static uint64_t drawFixed(minstd_rand& generator, uint64_t range) {
+	return (static_cast<uint64_t>(generator() - minstd_rand::min()) * range) >> 31;
+}
+
 void Wave::init() {
 	is_impossible = false;
 	data.fill(true);
+	switch (mode) {
+	case EntropyMode::DOUBLE:
+		fill(probabilities.begin(), probabilities.end(),
+			 initialProbability<Probability>(patterns, plogp_patterns));
+		break;
+	case EntropyMode::FLOAT:
+		fill(float_probabilities.begin(), float_probabilities.end(),
+			 initialProbability<FloatProbability>(float_patterns, float_plogp_patterns));
+		break;
+	case EntropyMode::FIXED:
+		fill(fixed_probabilities.begin(), fixed_probabilities.end(),
+			 initialProbability<FixedProbability>(fixed_patterns, fixed_plogp_patterns));
+		break;
+	}
+}
 
-	double base_sum = 0;
-	double base_entropy = 0;
-	for (uint32_t i = 0; i < patterns.size(); i++) {
-		base_sum += patterns[i];
-		base_entropy += plogp_patterns[i];
+Wave::Wave(uint32_t cells, const vector<double>& patterns, const vector<double>& plogp_patterns, EntropyMode mode,
+		   Arena* arena)
+	: data(ArenaAllocator<uint8_t>(arena), cells, patterns.size()), mode(mode), patterns(patterns),
+	  plogp_patterns(plogp_patterns), min_abs_half_plogp(calculate_min_abs_half(plogp_patterns)),
+	  float_min_abs_half_plogp(min_abs_half_plogp), fixed_noise(1),
+	  probabilities(mode == EntropyMode::DOUBLE ? cells : 0, ArenaAllocator<Probability>(arena)),
+	  float_probabilities(mode == EntropyMode::FLOAT ? cells : 0, ArenaAllocator<FloatProbability>(arena)),
+	  fixed_probabilities(mode == EntropyMode::FIXED ? cells : 0, ArenaAllocator<FixedProbability>(arena)),
+	  removals(nullptr), cells(cells) {
+	if (mode == EntropyMode::FLOAT) {
+		float_patterns.assign(patterns.begin(), patterns.end());
+		float_plogp_patterns.assign(plogp_patterns.begin(), plogp_patterns.end());
+	} else if (mode == EntropyMode::FIXED) {
+		// Rounding the normalized weights only takes IEEE operations, so the integers are the same everywhere
+		uint64_t sum = 0;
+		for (uint32_t p = 0; p < patterns.size(); p++) {
+			uint32_t weight = llround(patterns[p] * (1 << LOG_BITS));
+			fixed_patterns.push_back(weight == 0 && patterns[p] > 0 ? 1 : weight);
+			fixed_plogp_patterns.push_back(weight == 0 ? 0 : fixed_patterns[p] * fixedLog2(fixed_patterns[p]));
+			sum += fixed_patterns[p];
+		}
+		// Half the smallest -p log2(p), as in the other modes
+		int64_t noise = numeric_limits<int64_t>::max();
+		for (uint32_t p = 0; p < patterns.size(); p++)
+			if (fixed_patterns[p] > 0)
+				noise = min(noise, fixed_patterns[p] * (fixedLog2(sum) - fixedLog2(fixed_patterns[p])) /
+									   static_cast<int64_t>(sum) / 2);
+		fixed_noise = max<int64_t>(1, noise);
 	}
-	double base_sum_log = log(base_sum);
-	double entropy_base = base_sum_log - base_entropy / base_sum;
+}
 
-	Probability probability;
-	probability.sum = base_sum;
-	probability.sum_log = base_sum_log;
-	probability.sum_plogp = base_entropy;
-	probability.entropy = entropy_base;
-	probability.remaining = patterns.size();
-	probabilities.fill(probability);
+size_t Wave::arenaSize(uint32_t cells, uint32_t patterns, EntropyMode mode) {
+	size_t probability_size = sizeof(Probability);
+	if (mode == EntropyMode::FLOAT)
+		probability_size = sizeof(FloatProbability);
+	else if (mode == EntropyMode::FIXED)
+		probability_size = sizeof(FixedProbability);
+	return Arena::footprint(static_cast<size_t>(cells) * patterns) + Arena::footprint(cells * probability_size);
 }
 
-Wave::Wave(vec2 size, const vector<double>& patterns)
-	: data(size.height(), size.width(), patterns.size()), patterns(patterns), plogp_patterns(calculate_plogp(patterns)),
-	  min_abs_half_plogp(calculate_min_abs_half(plogp_patterns)), probabilities(size.height(), size.width()),
-	  size(size) {}
+bool Wave::get(uint32_t cell, uint32_t pattern) const {
+	return data(cell, pattern);
+}
 
-bool Wave::get(vec2 index, uint32_t pattern) const {
-	return data(index.i, index.j, pattern);
+uint32_t Wave::ban(uint32_t cell, uint32_t pattern) {
+	switch (mode) {
+	case EntropyMode::FLOAT:
+		return removePatterns(float_probabilities[cell], float_patterns, float_plogp_patterns, &pattern, 1);
+	case EntropyMode::FIXED:
+		return removePatterns(fixed_probabilities[cell], fixed_patterns, fixed_plogp_patterns, &pattern, 1);
+	case EntropyMode::DOUBLE:
+	default:
+		return removePatterns(probabilities[cell], patterns, plogp_patterns, &pattern, 1);
+	}
 }
 
-void Wave::set(vec2 index, uint32_t pattern, bool value) {
-	bool prev_value = data(index.i, index.j, pattern);
+void Wave::set(uint32_t cell, uint32_t pattern, bool value) {
+	bool prev_value = data(cell, pattern);
 	if (prev_value == value)
 		return;
-	data(index.i, index.j, pattern) = value;
+	data(cell, pattern) = value;
 
-	Probability& probability = probabilities(index.i, index.j);
-	probability.sum -= patterns[pattern];
-	probability.sum_log = log(probability.sum);
-	probability.sum_plogp -= plogp_patterns[pattern];
-	probability.entropy = probability.sum_log - probability.sum_plogp / probability.sum;
-	probability.remaining--;
-	if (probability.remaining == 0)
+	if (ban(cell, pattern) == 0)
 		is_impossible = true;
+	if (removals != nullptr)
+		removals->push_back({cell, pattern});
+}
+
+void Wave::removeBanned(uint32_t cell, const vector<uint32_t>& banned, size_t first) {
+	size_t count = banned.size() - first;
+	if (count == 0)
+		return;
+	const uint32_t* removed = banned.data() + first;
+	uint32_t remaining = 0;
+	switch (mode) {
+	case EntropyMode::DOUBLE:
+		remaining = removePatterns(probabilities[cell], patterns, plogp_patterns, removed, count);
+		break;
+	case EntropyMode::FLOAT:
+		remaining = removePatterns(float_probabilities[cell], float_patterns, float_plogp_patterns, removed, count);
+		break;
+	case EntropyMode::FIXED:
+		remaining = removePatterns(fixed_probabilities[cell], fixed_patterns, fixed_plogp_patterns, removed, count);
+		break;
+	}
+	if (remaining == 0)
+		is_impossible = true;
+}
+
+void Wave::restrict(uint32_t cell, const uint8_t* allowed, vector<uint32_t>& banned) {
+	uint8_t* domain = &data(cell, 0);
+	size_t first = banned.size();
+	for (uint32_t pattern = 0; pattern < patterns.size(); pattern++) {
+		if (!domain[pattern] || allowed[pattern])
+			continue;
+		domain[pattern] = false;
+		banned.push_back(pattern);
+		if (removals != nullptr)
+			removals->push_back({cell, pattern});
+	}
+	removeBanned(cell, banned, first);
+}
+
+void Wave::collapse(uint32_t cell, uint32_t pattern, vector<uint32_t>& banned) {
+	uint8_t* domain = &data(cell, 0);
+	size_t first = banned.size();
+	for (uint32_t p = 0; p < patterns.size(); p++) {
+		if (!domain[p] || p == pattern)
+			continue;
+		domain[p] = false;
+		banned.push_back(p);
+		if (removals != nullptr)
+			removals->push_back({cell, p});
+	}
+	removeBanned(cell, banned, first);
+}
+
+WaveState Wave::save() const {
+	WaveState state = {Array2D<uint8_t>(cells, patterns.size()),
+					   vector<Probability>(probabilities.begin(), probabilities.end()),
+					   vector<FloatProbability>(float_probabilities.begin(), float_probabilities.end()),
+					   vector<FixedProbability>(fixed_probabilities.begin(), fixed_probabilities.end()), is_impossible};
+	memcpy(&state.data(0, 0), &data(0, 0), static_cast<size_t>(cells) * patterns.size());
+	return state;
+}
+
+void Wave::restore(const WaveState& state) {
+	if (state.data.getSize(0) != cells || state.data.getSize(1) != patterns.size() ||
+		state.probabilities.size() != probabilities.size() ||
+		state.float_probabilities.size() != float_probabilities.size() ||
+		state.fixed_probabilities.size() != fixed_probabilities.size())
+		throw invalid_argument("Wave state of another size or entropy mode");
+	// Copied into the buffers of the wave so they stay in its arena
+	memcpy(&data(0, 0), &state.data(0, 0), static_cast<size_t>(cells) * patterns.size());
+	probabilities.assign(state.probabilities.begin(), state.probabilities.end());
+	float_probabilities.assign(state.float_probabilities.begin(), state.float_probabilities.end());
+	fixed_probabilities.assign(state.fixed_probabilities.begin(), state.fixed_probabilities.end());
+	is_impossible = state.is_impossible;
+	if (removals == nullptr)
+		return;
+	for (uint32_t cell = 0; cell < cells; cell++)
+		for (uint32_t pattern = 0; pattern < patterns.size(); pattern++)
+			if (!data(cell, pattern))
+				removals->push_back({cell, pattern});
+}
+
+bool Wave::impossible() const {
+	return is_impossible;
+}
+
+uint32_t Wave::remaining(uint32_t cell) const {
+	switch (mode) {
+	case EntropyMode::FLOAT:
+		return float_probabilities[cell].remaining;
+	case EntropyMode::FIXED:
+		return fixed_probabilities[cell].remaining;
+	case EntropyMode::DOUBLE:
+	default:
+		return probabilities[cell].remaining;
+	}
+}
+
+double Wave::entropy(uint32_t cell) const {
+	switch (mode) {
+	case EntropyMode::FLOAT:
+		return float_probabilities[cell].entropy;
+	case EntropyMode::FIXED:
+		return static_cast<double>(fixed_probabilities[cell].entropy) / (1 << LOG_BITS) * log(2.0);
+	case EntropyMode::DOUBLE:
+	default:
+		return probabilities[cell].entropy;
+	}
 }
 
-ObserveStatus Wave::getMinEntropy(minstd_rand& generator, vec2& argmin) const {
+double Wave::weight(uint32_t pattern) const {
+	switch (mode) {
+	case EntropyMode::FLOAT:
+		return float_patterns[pattern];
+	case EntropyMode::FIXED:
+		return fixed_patterns[pattern];
+	case EntropyMode::DOUBLE:
+	default:
+		return patterns[pattern];
+	}
+}
+
+void Wave::recordRemovals(vector<Removal>* removals) {
+	this->removals = removals;
+}
+
+ObserveStatus Wave::getMinEntropy(minstd_rand& generator, uint32_t& argmin) const {
 	if (is_impossible)
 		return ObserveStatus::FAILURE;
 
-	bool all_collapsed = true;
-	double min = numeric_limits<double>::infinity();
-	uniform_real_distribution<double> distribution(0, min_abs_half_plogp);
-
-	for (uint32_t i = 0; i < size.height(); i++) {
-		for (uint32_t j = 0; j < size.width(); j++) {
-			if (probabilities(i, j).remaining == 1)
-				continue;
-
-			double entropy = probabilities(i, j).entropy;
-			if (entropy <= min) {
-				double noise = distribution(generator);
-				if (entropy + noise < min) {
-					min = entropy + noise;
-					all_collapsed = false;
-					argmin = vec2(i, j);
-				}
-			}
+	switch (mode) {
+	case EntropyMode::FLOAT: {
+		// Drawn as in double mode so both consume the generator alike and differ only by the rounding
+		uniform_real_distribution<double> distribution(0, float_min_abs_half_plogp);
+		return findMinEntropy(
+			float_probabilities, [&]() { return static_cast<float>(distribution(generator)); }, argmin);
+	}
+	case EntropyMode::FIXED:
+		return findMinEntropy(
+			fixed_probabilities, [&]() { return static_cast<int32_t>(drawFixed(generator, fixed_noise)); }, argmin);
+	case EntropyMode::DOUBLE:
+	default: {
+		uniform_real_distribution<double> distribution(0, min_abs_half_plogp);
+		return findMinEntropy(probabilities, [&]() { return distribution(generator); }, argmin);
+	}
+	}
+}
+
+// Masked weights are added as zeroes rather than skipped, the sums and the subtractions are done in the same
+// order as a loop over the patterns so the draw doesn't depend on how the loops are compiled
+uint32_t Wave::choose(uint32_t cell, minstd_rand& generator) const {
+	const uint8_t* domain = &data(cell, 0);
+	uint32_t pattern_count = patterns.size();
+	if (mode == EntropyMode::FIXED) {
+		const uint32_t* weights = fixed_patterns.data();
+		uint64_t sum = 0;
+		for (uint32_t p = 0; p < pattern_count; p++)
+			sum += domain[p] ? weights[p] : 0;
+		uint64_t target = drawFixed(generator, sum);
+		for (uint32_t p = 0; p < pattern_count; p++) {
+			uint64_t weight = domain[p] ? weights[p] : 0;
+			if (target < weight)
+				return p;
+			target -= weight;
 		}
+		return pattern_count - 1;
 	}
-	return all_collapsed ? ObserveStatus::SUCCESS : ObserveStatus::CONTINUE;
+
+	const double* weights = patterns.data();
+	double sum = 0;
+	for (uint32_t p = 0; p < pattern_count; p++)
+		sum += domain[p] ? weights[p] : 0;
+
+	uniform_real_distribution<double> distribution(0, sum);
+	double random_value = distribution(generator);
+	for (uint32_t p = 0; p < pattern_count; p++) {
+		random_value -= domain[p] ? weights[p] : 0;
+		if (random_value <= 0)
+			return p;
+	}
+	return pattern_count - 1;
 }
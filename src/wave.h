@@ -3,38 +3,107 @@
 
 #include <random>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
+#include "arena.h"
 #include "multi_array.h"
 #include "propagator.h"
 
 using namespace std;
 
-struct Probability {
-	double sum;
-	double sum_log;
-	double sum_plogp;
-	double entropy;
+// Arithmetic of the entropies, chosen when a model is built
+// Float halves the state of every cell, fixed point uses integer weights and a log2 table so the
+// solves are the same with every compiler and CPU
+enum class EntropyMode : uint32_t { DOUBLE, FLOAT, FIXED };
+
+EntropyMode ParseEntropyMode(const string& name);
+const char* EntropyModeName(EntropyMode mode);
+
+template <typename Real>
+struct BasicProbability {
+	Real sum;
+	Real sum_log;
+	Real sum_plogp;
+	Real entropy;
+	uint32_t remaining;
+};
+
+typedef BasicProbability<double> Probability;
+typedef BasicProbability<float> FloatProbability;
+
+// Weights are integers summing to about 2^24, logarithms are in base 2 with 24 fractional bits
+struct FixedProbability {
+	uint64_t sum;
+	int64_t sum_plogp;
+	int32_t entropy;
 	uint32_t remaining;
 };
 
 enum class ObserveStatus { FAILURE, CONTINUE, SUCCESS };
 
+// A pattern removed from the domain of a cell
+struct Removal {
+	uint32_t cell;
+	uint32_t pattern;
+};
+
+// Domains and probabilities of every cell, to start solves from a wave that was already constrained
+struct WaveState {
+	Array2D<uint8_t> data;
+	vector<Probability> probabilities;
+	vector<FloatProbability> float_probabilities;
+	vector<FixedProbability> fixed_probabilities;
+	bool is_impossible;
+};
+
 class Wave {
 private:
 	bool is_impossible;
-	Array3D<uint8_t> data;
+	ArrayND<uint8_t, 2, ArenaAllocator<uint8_t>> data; // Per cell
+	const EntropyMode mode;
 	const vector<double> patterns;
 	const vector<double> plogp_patterns;
 	const double min_abs_half_plogp;
-	Array2D<Probability> probabilities;
+	// Weights and noise of the other modes, empty in double mode
+	vector<float> float_patterns;
+	vector<float> float_plogp_patterns;
+	float float_min_abs_half_plogp;
+	vector<uint32_t> fixed_patterns;
+	vector<int64_t> fixed_plogp_patterns;
+	int64_t fixed_noise;
+	// Per cell, only the vector of the mode is allocated
+	ArenaVector<Probability> probabilities;
+	ArenaVector<FloatProbability> float_probabilities;
+	ArenaVector<FixedProbability> fixed_probabilities;
+	vector<Removal>* removals; // Appended to by set when recording
+	uint32_t ban(uint32_t cell, uint32_t pattern); // Remaining patterns
+	void removeBanned(uint32_t cell, const vector<uint32_t>& banned, size_t first); // Updates the probabilities
 public:
-	const vec2 size;
-	Wave(vec2 size, const vector<double>& patterns);
-	bool get(vec2 index, uint32_t pattern) const;
-	void set(vec2 index, uint32_t pattern, bool value);
-	ObserveStatus getMinEntropy(minstd_rand& generator, vec2& argmin) const;
+	const uint32_t cells;
+	// The domains and probabilities are allocated from the arena when there is one
+	Wave(uint32_t cells, const vector<double>& patterns, const vector<double>& plogp_patterns, EntropyMode mode,
+		 Arena* arena = nullptr);
+	static size_t arenaSize(uint32_t cells, uint32_t patterns, EntropyMode mode); // Bytes taken in an arena
+	bool get(uint32_t cell, uint32_t pattern) const;
+	void set(uint32_t cell, uint32_t pattern, bool value);
+	// Removes the patterns of a cell that allowed (one byte per pattern) excludes, appending them to banned,
+	// the probabilities are updated once for all of them
+	void restrict(uint32_t cell, const uint8_t* allowed, vector<uint32_t>& banned);
+	// Removes every pattern of a cell but one, appending them to banned, in one pass over its domain
+	void collapse(uint32_t cell, uint32_t pattern, vector<uint32_t>& banned);
+	ObserveStatus getMinEntropy(minstd_rand& generator, uint32_t& argmin) const;
+	// Pattern drawn among the remaining ones of a cell according to their weights
+	uint32_t choose(uint32_t cell, minstd_rand& generator) const;
 	void init();
+	WaveState save() const;
+	void restore(const WaveState& state); // Every pattern the state lacks is recorded as removed
+	bool impossible() const;
+	// The state of a cell and the weights in the arithmetic of the mode, to compare the modes
+	uint32_t remaining(uint32_t cell) const;
+	double entropy(uint32_t cell) const; // In nats
+	double weight(uint32_t pattern) const; // As drawn by choose, fixed weights sum to about 2^24
+	void recordRemovals(vector<Removal>* removals); // nullptr stops recording
 };
 
 #endif
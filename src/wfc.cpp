@@ -1,76 +1,83 @@
-#include <limits>
 #include <stdexcept>
 
 #include "wfc.h"
 
-static vector<double> normalize(const vector<double>& distribution) {
-	double sum_weights = 0.0;
-	for (uint32_t i = 0; i < distribution.size(); i++)
-		sum_weights += distribution[i];
-
-	if (sum_weights == 0)
-		throw runtime_error("Can't normalize vector of all zeroes");
-
-	double inv_sum_weights = 1.0 / sum_weights;
-	vector<double> normalized(distribution.size());
-	for (uint32_t i = 0; i < distribution.size(); i++)
-		normalized[i] = distribution[i] * inv_sum_weights;
-	return normalized;
-}
-
 ObserveStatus WFC::observe() {
-	vec2 argmin;
+	uint32_t argmin;
 	ObserveStatus status = wave.getMinEntropy(generator, argmin);
 	if (status != ObserveStatus::CONTINUE)
 		return status;
 
-	double sum = 0;
+	uint32_t chosen_value = wave.choose(argmin, generator);
+	banned.clear();
+	wave.collapse(argmin, chosen_value, banned);
+	// Queued one by one in the order of the patterns, recounting the supports as pushPatterns would reorder the
+	// removals of the neighbors and with them the rounding of their entropies
+	for (vector<uint32_t>::const_iterator it = banned.begin(); it != banned.end(); it++)
+		propagator.pushPattern(argmin, *it);
+	return ObserveStatus::CONTINUE;
+}
+
+uint32_t WFC::patternAt(uint32_t cell) const {
+	uint32_t pattern = 0;
 	for (uint32_t p = 0; p < patterns.size(); p++)
-		sum += wave.get(argmin, p) ? patterns[p] : 0;
+		if (wave.get(cell, p))
+			pattern = p;
+	return pattern;
+}
 
-	uniform_real_distribution<double> distribution(0, sum);
-	double random_value = distribution(generator);
-	uint32_t chosen_value = patterns.size() - 1;
+WFC::WFC(shared_ptr<const Topology> topology, shared_ptr<const CompiledModel> model, const ArenaOptions& memory)
+	: model(model), patterns(model->weights), topology(topology),
+	  arena(make_unique<Arena>(Wave::arenaSize(topology->cells(), model->size(), model->entropy) +
+								   Propagator::arenaSize(*topology, model->propagator),
+							   memory)),
+	  wave(topology->cells(), patterns, model->plogp, model->entropy, arena.get()),
+	  propagator(*topology, model->propagator, arena.get()) {}
 
-	for (uint32_t p = 0; p < patterns.size(); p++) {
-		random_value -= wave.get(argmin, p) ? patterns[p] : 0;
-		if (random_value <= 0) {
-			chosen_value = p;
-			break;
-		}
-	}
+WFC::WFC(vec3 size, shared_ptr<const CompiledModel> model, bool periodic_output, const ArenaOptions& memory)
+	: WFC(make_shared<const Topology>(Topology::grid(size, model->propagator.getSize(0), periodic_output)), model,
+		  memory) {}
 
-	for (uint32_t p = 0; p < patterns.size(); p++) {
-		if (wave.get(argmin, p) ^ (p == chosen_value)) {
-			propagator.pushPattern(argmin, p);
-			wave.set(argmin, p, false);
-		}
-	}
-	return ObserveStatus::CONTINUE;
-}
+WFC::WFC(vec2 size, shared_ptr<const CompiledModel> model, bool periodic_output, const ArenaOptions& memory)
+	: WFC(vec3(size.i, size.j, 1), model, periodic_output, memory) {}
 
-Array2D<uint32_t> WFC::toOutput() const {
-	Array2D<uint32_t> output(wave.size.height(), wave.size.width());
-	for (uint32_t i = 0; i < wave.size.height(); i++)
-		for (uint32_t j = 0; j < wave.size.width(); j++)
-			for (uint32_t p = 0; p < patterns.size(); p++)
-				if (wave.get(vec2(i, j), p))
-					output(i, j) = p;
+optional<Array2D<uint32_t>> WFC::execute(int seed) {
+	if (topology->size.depth() != 1)
+		throw logic_error("Layered wave solved as a single layer");
+	if (!run(seed))
+		return nullopt;
+	Array2D<uint32_t> output(topology->size.height(), topology->size.width());
+	for (uint32_t i = 0; i < topology->size.height(); i++)
+		for (uint32_t j = 0; j < topology->size.width(); j++)
+			output(i, j) = patternAt(i * topology->size.width() + j);
 	return output;
 }
 
-WFC::WFC(vec2 size, const PropagatorState& state, const vector<double>& patterns, bool periodic_output)
-	: patterns(normalize(patterns)), wave(size, this->patterns), propagator(size, state, periodic_output) {}
+optional<Array3D<uint32_t>> WFC::executeVolume(int seed) {
+	if (!run(seed))
+		return nullopt;
+	Array3D<uint32_t> output(topology->size.depth(), topology->size.height(), topology->size.width());
+	for (uint32_t k = 0; k < topology->size.depth(); k++)
+		for (uint32_t i = 0; i < topology->size.height(); i++)
+			for (uint32_t j = 0; j < topology->size.width(); j++)
+				output(k, i, j) = patternAt(vec3(i, j, k).flatten(topology->size));
+	return output;
+}
 
-optional<Array2D<uint32_t>> WFC::execute(int seed) {
+bool WFC::run(int seed) {
 	generator = minstd_rand(seed);
 	while (true) {
 		ObserveStatus result = observe();
-		if (result == ObserveStatus::SUCCESS)
-			return toOutput();
+		if (result == ObserveStatus::SUCCESS) {
+			if (capture)
+				capture->flush();
+			return true;
+		}
 		if (result == ObserveStatus::FAILURE)
-			return nullopt;
+			return false;
 		propagator.propagate(wave);
+		if (capture)
+			capture->step();
 	}
 }
 
@@ -78,15 +85,97 @@ void WFC::propagate() {
 	propagator.propagate(wave);
 }
 
+void WFC::collapse(uint32_t cell, uint32_t pattern) {
+	if (wave.get(cell, pattern)) {
+		wave.set(cell, pattern, false);
+		propagator.pushPattern(cell, pattern);
+	}
+}
+
+void WFC::collapse(vec3 index, uint32_t pattern) {
+	collapse(index.flatten(topology->size), pattern);
+}
+
 void WFC::collapse(vec2 index, uint32_t pattern) {
-	if (wave.get(index, pattern)) {
-		wave.set(index, pattern, false);
-		propagator.pushPattern(index, pattern);
+	collapse(vec3(index), pattern);
+}
+
+void WFC::constrain(uint32_t cell, const vector<uint8_t>& allowed) {
+	if (cell >= wave.cells)
+		throw out_of_range("Constrained cell out of range");
+	if (allowed.size() != patterns.size())
+		throw invalid_argument("Constraint mask doesn't match the pattern count");
+	banned.clear();
+	wave.restrict(cell, allowed.data(), banned);
+	propagator.pushPatterns(wave, cell, banned);
+}
+
+void WFC::constrain(vec3 origin, vec3 extent, const vector<uint8_t>& allowed) {
+	if (extent.volume() == 0)
+		return;
+	if (!origin.inRange(topology->size) || !(origin + extent + vec3(-1, -1, -1)).inRange(topology->size))
+		throw out_of_range("Constrained box out of range");
+	for (uint32_t k = 0; k < extent.depth(); k++)
+		for (uint32_t i = 0; i < extent.height(); i++)
+			for (uint32_t j = 0; j < extent.width(); j++)
+				constrain((origin + vec3(i, j, k)).flatten(topology->size), allowed);
+}
+
+void WFC::constrain(const Array2D<uint8_t>& allowed) {
+	if (allowed.getSize(0) != wave.cells || allowed.getSize(1) != patterns.size())
+		throw invalid_argument("Constraint masks don't match the cells and patterns");
+	for (uint32_t cell = 0; cell < wave.cells; cell++) {
+		banned.clear();
+		wave.restrict(cell, &allowed(cell, 0), banned);
+		propagator.pushPatterns(wave, cell, banned);
 	}
 }
 
 void WFC::init() {
 	// Finish initialization, reset values for next execution
-	wave.init();
-	propagator.init();
+	if (capture)
+		capture->reset();
+	if (initial_state) {
+		wave.restore(initial_state->wave);
+		propagator.restore(initial_state->compatible);
+	} else {
+		wave.init();
+		propagator.init();
+	}
+}
+
+shared_ptr<const WFCState> WFC::snapshot() const {
+	return make_shared<const WFCState>(WFCState{wave.save(), propagator.counts()});
+}
+
+bool WFC::impossible() const {
+	return wave.impossible();
+}
+
+void WFC::setInitialState(shared_ptr<const WFCState> state) {
+	initial_state = state;
+}
+
+shared_ptr<const WFCState> WFC::setInitialConstraints(const Array2D<uint8_t>& allowed) {
+	initial_state = nullptr;
+	init();
+	constrain(allowed);
+	propagator.propagate(wave);
+	if (wave.impossible())
+		throw runtime_error("The constraints contradict the rules of the model");
+	initial_state = snapshot();
+	return initial_state;
+}
+
+void WFC::captureFrames(uint32_t interval, uint32_t delay_ms, uint32_t edge) {
+	if (topology->size.depth() != 1)
+		throw logic_error("Only single layer solves can be recorded");
+	capture = make_unique<FrameCapture>(vec2(topology->size.i, topology->size.j), *model, interval, delay_ms, edge);
+	wave.recordRemovals(capture->removalLog());
+}
+
+void WFC::saveAnimation(const string& path) {
+	if (!capture)
+		throw logic_error("Frames are not captured");
+	capture->save(path);
 }
@@ -1,35 +1,79 @@
 #ifndef WFC_H
 #define WFC_H
 
+#include <memory>
 #include <optional>
 #include <random>
 #include <stdint.h>
 
+#include "arena.h"
+#include "compiled_model.h"
+#include "frame_capture.h"
 #include "image.h"
 #include "multi_array.h"
 #include "propagator.h"
+#include "topology.h"
 #include "wave.h"
 
 using namespace std;
 
 struct WFCOptions {
 	bool periodic_output;
+	ArenaOptions memory; // Of the solver state
+};
+
+// Wave and supports of a solver after constraining and propagating
+struct WFCState {
+	WaveState wave;
+	vector<uint32_t> compatible;
 };
 
 class WFC {
 private:
-	const vector<double> patterns; // Normalized before wave initialization
+	const shared_ptr<const CompiledModel> model; // Shared by every solver of the model
+	const vector<double>& patterns;              // Normalized
+	const shared_ptr<const Topology> topology;
+	unique_ptr<Arena> arena; // Wave and supports, mapped once and reused by every execution
 	Wave wave;
 	Propagator propagator;
 	minstd_rand generator;
+	unique_ptr<FrameCapture> capture; // Only when recording the solve
+	shared_ptr<const WFCState> initial_state;
+	vector<uint32_t> banned;          // Scratch list of the patterns removed by a constraint
 	ObserveStatus observe();
-	Array2D<uint32_t> toOutput() const;
+	bool run(int seed); // False on a contradiction
+	uint32_t patternAt(uint32_t cell) const;
 public:
-	WFC(vec2 size, const PropagatorState& state, const vector<double>& patterns, bool periodic_output);
-	optional<Array2D<uint32_t>> execute(int seed);
+	WFC(shared_ptr<const Topology> topology, shared_ptr<const CompiledModel> model,
+		const ArenaOptions& memory = ArenaOptions());
+	WFC(vec3 size, shared_ptr<const CompiledModel> model, bool periodic_output, // On a grid
+		const ArenaOptions& memory = ArenaOptions());
+	WFC(vec2 size, shared_ptr<const CompiledModel> model, bool periodic_output,
+		const ArenaOptions& memory = ArenaOptions());
+	optional<Array2D<uint32_t>> execute(int seed);       // Of a single layer
+	optional<Array3D<uint32_t>> executeVolume(int seed); // Indexed by layer, row and column
 	void propagate();
+	void collapse(uint32_t cell, uint32_t pattern);
+	void collapse(vec3 index, uint32_t pattern);
 	void collapse(vec2 index, uint32_t pattern);
+	// Bans in one step every pattern a mask of one byte per pattern doesn't allow, like collapse the bans
+	// are only propagated by the next call to propagate
+	void constrain(uint32_t cell, const vector<uint8_t>& allowed);
+	void constrain(vec3 origin, vec3 extent, const vector<uint8_t>& allowed); // Same mask in a box of cells
+	void constrain(const Array2D<uint8_t>& allowed);                          // A mask per cell
 	void init();
+	// Must follow a propagation, the state can be restored by any solver of the same model and topology
+	shared_ptr<const WFCState> snapshot() const;
+	bool impossible() const;
+	// Restored by every following init instead of the unconstrained wave, nullptr goes back to it
+	void setInitialState(shared_ptr<const WFCState> state);
+	// Constrains with a mask per cell and propagates once, then sets the result as the initial state
+	// The state is returned so other solvers can share it, throws if the constraints contradict the rules
+	shared_ptr<const WFCState> setInitialConstraints(const Array2D<uint8_t>& allowed);
+	// Records every following execution as an animation with a frame every interval observations
+	// The frames are edge pixels larger than the grid, for the overlapping patterns of non-periodic outputs
+	void captureFrames(uint32_t interval, uint32_t delay_ms, uint32_t edge = 0);
+	void saveAnimation(const string& path); // Of the last execution
 };
 
 #endif
@@ -0,0 +1,191 @@
+/* Exercises the C interface of libwfc, linked statically or dynamically by make check
+ * Prints a line per case, compared with tests/capi.expected, and exits with 1 on a broken invariant */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libwfc.h"
+
+static int failures = 0;
+
+static void expect(int condition, const char* what) {
+	if (!condition) {
+		printf("FAILED %s: %s\n", what, wfc_last_error());
+		failures++;
+	}
+}
+
+/* 64-bit FNV-1a, as used for the pixels of tests/check_pixels.expected */
+static unsigned long long hashBytes(const uint8_t* data, size_t size) {
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for (size_t k = 0; k < size; k++) {
+		hash ^= data[k];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+/* Checkerboard of one pixel squares, any N x N window of it is a pattern of the outputs */
+static void overlapping(void) {
+	enum { H = 8, W = 8 };
+	uint8_t pixels[H * W * 3];
+	for (int i = 0; i < H; i++)
+		for (int j = 0; j < W; j++)
+			memset(pixels + (i * W + j) * 3, (i + j) % 2 == 0 ? 255 : 0, 3);
+	wfc_overlapping_options options = {2, 8, 1, 0};
+	wfc_model* model = wfc_overlapping_model_create(pixels, H, W, &options);
+	expect(model != NULL, "overlapping model");
+	wfc_solver* solver = wfc_solver_create(model, 48, 48, 1);
+	wfc_status status = wfc_solver_run(solver, 7);
+	uint32_t image_height, image_width, grid_height, grid_width;
+	wfc_solver_image_size(solver, &image_height, &image_width);
+	wfc_solver_grid_size(solver, &grid_height, &grid_width);
+	uint8_t* image = malloc((size_t)image_height * image_width * 3);
+	uint32_t* grid = malloc((size_t)grid_height * grid_width * sizeof(uint32_t));
+	expect(wfc_solver_copy_rgb(solver, image, (size_t)image_height * image_width * 3) == WFC_OK, "copy rgb");
+	expect(wfc_solver_copy_patterns(solver, grid, (size_t)grid_height * grid_width) == WFC_OK, "copy patterns");
+	for (uint32_t i = 0; i < image_height; i++)
+		for (uint32_t j = 0; j + 1 < image_width; j++)
+			expect(image[(i * image_width + j) * 3] != image[(i * image_width + j + 1) * 3], "checkerboard output");
+	printf("overlapping status %d patterns %u grid %ux%u image %ux%u %016llx\n", status,
+		   wfc_model_pattern_count(model), grid_height, grid_width, image_height, image_width,
+		   hashBytes(image, (size_t)image_height * image_width * 3));
+	expect(wfc_solver_copy_rgb(solver, image, 5) == WFC_ERROR, "short buffer");
+	printf("short buffer: %s\n", wfc_last_error());
+	uint32_t tile, orientation;
+	expect(wfc_model_pattern_tile(model, 0, &tile, &orientation) == WFC_ERROR, "tile of overlapping pattern");
+	printf("tile of overlapping pattern: %s\n", wfc_last_error());
+	free(image);
+	free(grid);
+	wfc_solver_destroy(solver);
+	wfc_model_destroy(model);
+}
+
+/* One red tile that may only be next to itself */
+static void simpletiled(void) {
+	uint8_t red[2 * 2 * 3] = {255, 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0};
+	wfc_tile tiles[1] = {{red, 2, 'X', 1.0, 0}};
+	wfc_neighbor neighbors[1] = {{0, 0, 0, 0}};
+	wfc_model* model = wfc_simpletiled_model_create(tiles, 1, neighbors, 1);
+	expect(model != NULL, "simpletiled model");
+	wfc_solver* solver = wfc_solver_create(model, 3, 4, 0);
+	wfc_status status = wfc_solver_run(solver, 1);
+	uint32_t height, width;
+	wfc_solver_image_size(solver, &height, &width);
+	uint8_t image[6 * 8 * 3];
+	expect(wfc_solver_copy_rgb(solver, image, sizeof(image)) == WFC_OK, "copy tiled rgb");
+	printf("simpletiled status %d image %ux%u %016llx\n", status, height, width, hashBytes(image, sizeof(image)));
+	wfc_solver_destroy(solver);
+	wfc_model_destroy(model);
+}
+
+/* Black and white tiles alternating along both axes */
+static void imagemosaic(void) {
+	uint8_t black[3 * 3 * 3] = {0};
+	uint8_t white[3 * 3 * 3];
+	memset(white, 255, sizeof(white));
+	wfc_mosaic_tile tiles[2] = {{black, 3, 3, 1.0}, {white, 3, 3, 1.0}};
+	uint8_t allowed[4 * 2 * 2];
+	for (int d = 0; d < 4; d++)
+		for (int a = 0; a < 2; a++)
+			for (int b = 0; b < 2; b++)
+				allowed[(d * 2 + a) * 2 + b] = a != b;
+	wfc_model* model = wfc_imagemosaic_model_create(tiles, 2, allowed);
+	expect(model != NULL, "imagemosaic model");
+	wfc_solver* solver = wfc_solver_create(model, 4, 6, 1);
+	wfc_status status = wfc_solver_run(solver, 3);
+	uint32_t grid[4 * 6];
+	expect(wfc_solver_copy_patterns(solver, grid, 4 * 6) == WFC_OK, "copy mosaic patterns");
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 6; j++)
+			expect(grid[i * 6 + j] != grid[i * 6 + (j + 1) % 6] && grid[i * 6 + j] != grid[(i + 1) % 4 * 6 + j],
+				   "alternating mosaic");
+	printf("imagemosaic status %d first tile %u\n", status, grid[0]);
+	wfc_solver_destroy(solver);
+	wfc_model_destroy(model);
+}
+
+/* 3-coloring of a periodic hex map, checked against an independent odd-r neighborhood */
+static void hex(void) {
+	enum { T = 3, D = 6, H = 10, W = 12 };
+	uint8_t allowed[D * T * T];
+	for (int d = 0; d < D; d++)
+		for (int a = 0; a < T; a++)
+			for (int b = 0; b < T; b++)
+				allowed[(d * T + a) * T + b] = a != b;
+	double weights[T] = {1, 1, 1};
+	wfc_model* model = wfc_adjacency_model_create(weights, T, D, allowed);
+	wfc_topology* topology = wfc_hex_topology_create(H, W, 1);
+	wfc_solver* solver = wfc_solver_create_on(model, topology);
+	const int offsets[2][6][2] = {{{-1, -1}, {-1, 0}, {0, -1}, {0, 1}, {1, -1}, {1, 0}},
+								  {{-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, 0}, {1, 1}}};
+	int solved = 0;
+	unsigned long long hash = 0;
+	for (int seed = 0; seed < 50; seed++) {
+		if (wfc_solver_run(solver, seed) != WFC_OK)
+			continue;
+		uint32_t grid[H * W];
+		expect(wfc_solver_copy_patterns(solver, grid, H * W) == WFC_OK, "copy hex patterns");
+		for (int i = 0; i < H; i++)
+			for (int j = 0; j < W; j++)
+				for (int k = 0; k < 6; k++) {
+					int ni = (i + offsets[i % 2][k][0] + H) % H;
+					int nj = (j + offsets[i % 2][k][1] + W) % W;
+					expect(grid[i * W + j] != grid[ni * W + nj], "hex coloring");
+				}
+		if (solved++ == 0)
+			hash = hashBytes((const uint8_t*)grid, sizeof(grid));
+	}
+	printf("hex solved %d/50 first %016llx\n", solved, hash);
+	uint8_t pixel[3];
+	expect(wfc_solver_copy_rgb(solver, pixel, sizeof(pixel)) == WFC_ERROR, "render adjacency model");
+	printf("render adjacency model: %s\n", wfc_last_error());
+	expect(wfc_hex_topology_create(3, 4, 1) == NULL, "odd periodic hex");
+	printf("odd periodic hex: %s\n", wfc_last_error());
+	wfc_solver_destroy(solver);
+	wfc_topology_destroy(topology);
+	wfc_model_destroy(model);
+}
+
+/* Two colors alternating along a path of 5 cells, its one direction is its own opposite */
+static void graph(void) {
+	uint8_t allowed[2 * 2] = {0, 1, 1, 0};
+	double weights[2] = {1, 1};
+	wfc_model* model = wfc_adjacency_model_create(weights, 2, 1, allowed);
+	uint32_t opposite[1] = {0};
+	wfc_edge edges[8];
+	for (uint32_t c = 0; c < 4; c++) {
+		edges[2 * c] = (wfc_edge){c, c + 1, 0};
+		edges[2 * c + 1] = (wfc_edge){c + 1, c, 0};
+	}
+	wfc_topology* path = wfc_graph_topology_create(5, 1, opposite, edges, 8);
+	wfc_solver* solver = wfc_solver_create_on(model, path);
+	wfc_status status = wfc_solver_run(solver, 3);
+	uint32_t grid[5];
+	expect(wfc_solver_copy_patterns(solver, grid, 5) == WFC_OK, "copy graph patterns");
+	printf("graph status %d colors %u%u%u%u%u\n", status, grid[0], grid[1], grid[2], grid[3], grid[4]);
+
+	uint8_t asymmetric[2 * 2] = {1, 1, 0, 1};
+	wfc_model* invalid = wfc_adjacency_model_create(weights, 2, 1, asymmetric);
+	expect(wfc_solver_create_on(invalid, path) == NULL, "asymmetric rules");
+	printf("asymmetric rules: %s\n", wfc_last_error());
+	uint32_t bad_opposite[2] = {1, 1};
+	expect(wfc_graph_topology_create(2, 2, bad_opposite, edges, 0) == NULL, "bad opposite");
+	printf("bad opposite: %s\n", wfc_last_error());
+	expect(wfc_solver_create(model, 4, 4, 0) == NULL, "grid with one direction");
+	printf("grid with one direction: %s\n", wfc_last_error());
+	wfc_solver_destroy(solver);
+	wfc_topology_destroy(path);
+	wfc_model_destroy(invalid);
+	wfc_model_destroy(model);
+}
+
+int main(void) {
+	overlapping();
+	simpletiled();
+	imagemosaic();
+	hex();
+	graph();
+	return failures > 0;
+}
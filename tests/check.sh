@@ -0,0 +1,34 @@
+#!/bin/sh
+# Run by make check from the root of the repository: compares the outputs of tests/check.xml and of the C
+# interface with the expected ones, which were produced with g++ on x86-64 and may differ on other platforms
+# The cache is cleared first, so the first pass compiles the models and the second loads them
+
+status=0
+compare() {
+	if diff -u "$2" "$3" >/dev/null; then
+		echo "$1 OK"
+	else
+		echo "$1 FAILED"
+		diff -u "$2" "$3" | head -20
+		status=1
+	fi
+}
+
+mkdir -p output
+rm -rf cache
+outputs=$(cut -d ' ' -f 3 tests/check_pixels.expected)
+for pass in cold warm; do
+	for name in $outputs; do
+		rm -f "output/$name"
+	done
+	./wfc tests/check.xml | grep -v -e '^time' -e '^render' > obj/tests/check.out
+	compare "check $pass stdout" tests/check.expected obj/tests/check.out
+	(cd output && ../obj/tests/pixhash $outputs) > obj/tests/check_pixels.out 2>&1
+	compare "check $pass pixels" tests/check_pixels.expected obj/tests/check_pixels.out
+done
+
+obj/tests/capi_static > obj/tests/capi_static.out
+compare "C interface, static" tests/capi.expected obj/tests/capi_static.out
+LD_LIBRARY_PATH=. obj/tests/capi_shared > obj/tests/capi_shared.out
+compare "C interface, shared" tests/capi.expected obj/tests/capi_shared.out
+exit $status
@@ -0,0 +1,220 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/image.h"
+#include "../src/overlapping_wfc.h"
+#include "../src/propagator.h"
+#include "../src/topology.h"
+#include "../src/wave.h"
+
+using namespace std;
+using namespace chrono;
+
+// Compares the entropy modes on overlapping samples: the cost of a removal and of the minimum entropy scan, then
+// how the float and fixed point waves would select from the same states as the double wave
+// Run with make entropy_report from the root of the repository
+
+static const EntropyMode MODES[] = {EntropyMode::DOUBLE, EntropyMode::FLOAT, EntropyMode::FIXED};
+
+struct ReportSample {
+	const char* name;
+	uint32_t pattern_size;
+	uint32_t symmetry;
+};
+
+static CompiledModel compileSample(const ReportSample& sample, uint32_t size) {
+	OverlappingWFCOptions options;
+	options.periodic_output = true;
+	options.ground = false;
+	options.periodic_input = true;
+	options.out_size = vec2(size, size);
+	options.symmetry = sample.symmetry;
+	options.pattern_size = sample.pattern_size;
+	return OverlappingWFC::compile(LoadImage(string("samples/") + sample.name + ".png"), options);
+}
+
+// Observes the cell of minimum entropy and propagates until the wave is solved or contradicts itself,
+// calling visit before each observation
+template <typename Visit>
+static void solve(const CompiledModel& model, const Topology& topology, Wave& wave, int seed, Visit visit) {
+	Propagator propagator(topology, model.propagator);
+	wave.init();
+	propagator.init();
+	minstd_rand generator(seed);
+	vector<uint32_t> banned;
+	uint32_t argmin;
+	while (wave.getMinEntropy(generator, argmin) == ObserveStatus::CONTINUE) {
+		visit(argmin);
+		banned.clear();
+		wave.collapse(argmin, wave.choose(argmin, generator), banned);
+		for (vector<uint32_t>::const_iterator it = banned.begin(); it != banned.end(); it++)
+			propagator.pushPattern(argmin, *it);
+		propagator.propagate(wave);
+	}
+}
+
+// Replays the removals of a double solve of 64x64 in every mode, best of 5 runs
+static void benchmark() {
+	const ReportSample samples[] = {{"Knot", 3, 8}, {"Flowers", 3, 2}, {"Skyline", 3, 2}, {"RedMaze", 2, 8}};
+	const uint32_t size = 64;
+	printf("Cost per removal and of a minimum entropy scan, replaying the removals of a %ux%u double solve\n", size,
+		   size);
+	for (const ReportSample& sample : samples) {
+		CompiledModel model = compileSample(sample, size);
+		Topology topology = Topology::grid(vec3(size, size, 1), 4, true);
+		vector<Removal> removals;
+		Wave recorded(topology.cells(), model.weights, model.plogp, EntropyMode::DOUBLE);
+		recorded.recordRemovals(&removals);
+		solve(model, topology, recorded, 1, [](uint32_t) {});
+
+		for (EntropyMode mode : MODES) {
+			double removal_ns = INFINITY;
+			double scan_us = INFINITY;
+			for (uint32_t run = 0; run < 5; run++) {
+				Wave wave(topology.cells(), model.weights, model.plogp, mode);
+				wave.init();
+				steady_clock::time_point start = steady_clock::now();
+				for (size_t i = 0; i + 1 < removals.size(); i++)
+					wave.set(removals[i].cell, removals[i].pattern, false);
+				removal_ns = min(removal_ns, duration<double, nano>(steady_clock::now() - start).count() /
+												 removals.size());
+
+				// Half solved, so the scan sees cells of every entropy
+				Wave half(topology.cells(), model.weights, model.plogp, mode);
+				half.init();
+				for (size_t i = 0; i < removals.size() / 2; i++)
+					half.set(removals[i].cell, removals[i].pattern, false);
+				minstd_rand generator(2);
+				uint32_t argmin;
+				start = steady_clock::now();
+				for (uint32_t k = 0; k < 200; k++)
+					half.getMinEntropy(generator, argmin);
+				scan_us = min(scan_us, duration<double, micro>(steady_clock::now() - start).count() / 200);
+			}
+			printf("  %-8s P=%3u %-6s removal %5.1f ns  scan %6.1f us\n", sample.name, model.size(),
+				   EntropyModeName(mode), removal_ns, scan_us);
+		}
+	}
+	printf("  bytes per cell: double %zu, float %zu, fixed %zu\n\n", sizeof(Probability), sizeof(FloatProbability),
+		   sizeof(FixedProbability));
+}
+
+// Cells within tolerance of the minimum entropy among the undecided ones
+static vector<uint32_t> minimumCells(const Wave& wave) {
+	const double tolerance = 1e-5;
+	double minimum = INFINITY;
+	for (uint32_t cell = 0; cell < wave.cells; cell++)
+		if (wave.remaining(cell) > 1)
+			minimum = min(minimum, wave.entropy(cell));
+	vector<uint32_t> cells;
+	for (uint32_t cell = 0; cell < wave.cells; cell++)
+		if (wave.remaining(cell) > 1 && wave.entropy(cell) <= minimum + tolerance)
+			cells.push_back(cell);
+	return cells;
+}
+
+// Total variation between the pattern distributions of a cell under two sets of weights
+static double choiceDistance(const Wave& wave, const Wave& other, uint32_t cell, uint32_t patterns) {
+	double sum = 0;
+	double other_sum = 0;
+	for (uint32_t p = 0; p < patterns; p++)
+		if (wave.get(cell, p)) {
+			sum += wave.weight(p);
+			other_sum += other.weight(p);
+		}
+	double distance = 0;
+	for (uint32_t p = 0; p < patterns; p++)
+		if (wave.get(cell, p))
+			distance += fabs(wave.weight(p) / sum - other.weight(p) / other_sum);
+	return distance / 2;
+}
+
+struct Difference {
+	size_t same_cells = 0;
+	double entropy_error = 0;
+	double max_entropy_error = 0;
+	double choice_distance = 0;
+	double max_choice_distance = 0;
+	void add(const Wave& reference, const Wave& wave, uint32_t argmin, const vector<uint32_t>& minimum,
+			 uint32_t patterns) {
+		same_cells += minimumCells(wave) == minimum;
+		double error = fabs(wave.entropy(argmin) - reference.entropy(argmin));
+		entropy_error += error;
+		max_entropy_error = max(max_entropy_error, error);
+		double distance = choiceDistance(reference, wave, argmin, patterns);
+		choice_distance += distance;
+		max_choice_distance = max(max_choice_distance, distance);
+	}
+	void print(const char* mode, size_t observations) const {
+		printf("  %-6s same minimum entropy cells %5.1f%%  entropy error mean %.1e max %.1e nats  "
+			   "choice distance mean %.1e max %.1e\n",
+			   mode, 100.0 * same_cells / observations, entropy_error / observations, max_entropy_error,
+			   choice_distance / observations, max_choice_distance);
+	}
+};
+
+// The float and fixed point waves replay the removals of the double solve, and are compared with it before
+// every observation: whether the cells of minimum entropy are the same, the entropy of the observed cell and
+// the total variation distance of the pattern choice at it
+static void selectionDifference(uint32_t seeds) {
+	const ReportSample samples[] = {{"Hogs", 2, 8},	  {"Knot", 3, 8},	 {"RedMaze", 2, 8}, {"SimpleWall", 3, 2},
+									{"Water", 3, 1},  {"Flowers", 3, 2}, {"Skyline", 3, 2}, {"City", 3, 8}};
+	const uint32_t size = 32;
+	printf("Selection difference against double, %ux%u, %u seeds per sample\n", size, size, seeds);
+	size_t observations = 0;
+	Difference float_total;
+	Difference fixed_total;
+	for (const ReportSample& sample : samples) {
+		CompiledModel model = compileSample(sample, size);
+		Topology topology = Topology::grid(vec3(size, size, 1), 4, true);
+		uint32_t patterns = model.size();
+		size_t sample_observations = 0;
+		Difference float_difference;
+		Difference fixed_difference;
+		for (uint32_t seed = 0; seed < seeds; seed++) {
+			vector<Removal> removals;
+			size_t replayed = 0;
+			Wave reference(topology.cells(), model.weights, model.plogp, EntropyMode::DOUBLE);
+			Wave float_wave(topology.cells(), model.weights, model.plogp, EntropyMode::FLOAT);
+			Wave fixed_wave(topology.cells(), model.weights, model.plogp, EntropyMode::FIXED);
+			float_wave.init();
+			fixed_wave.init();
+			reference.recordRemovals(&removals);
+			solve(model, topology, reference, seed, [&](uint32_t argmin) {
+				for (; replayed < removals.size(); replayed++) {
+					float_wave.set(removals[replayed].cell, removals[replayed].pattern, false);
+					fixed_wave.set(removals[replayed].cell, removals[replayed].pattern, false);
+				}
+				vector<uint32_t> minimum = minimumCells(reference);
+				float_difference.add(reference, float_wave, argmin, minimum, patterns);
+				fixed_difference.add(reference, fixed_wave, argmin, minimum, patterns);
+				sample_observations++;
+			});
+		}
+		printf("%s, P=%u, %zu observations\n", sample.name, patterns, sample_observations);
+		float_difference.print("float", sample_observations);
+		fixed_difference.print("fixed", sample_observations);
+		observations += sample_observations;
+		float_total.same_cells += float_difference.same_cells;
+		float_total.entropy_error += float_difference.entropy_error;
+		float_total.max_entropy_error = max(float_total.max_entropy_error, float_difference.max_entropy_error);
+		float_total.choice_distance += float_difference.choice_distance;
+		float_total.max_choice_distance = max(float_total.max_choice_distance, float_difference.max_choice_distance);
+		fixed_total.same_cells += fixed_difference.same_cells;
+		fixed_total.entropy_error += fixed_difference.entropy_error;
+		fixed_total.max_entropy_error = max(fixed_total.max_entropy_error, fixed_difference.max_entropy_error);
+		fixed_total.choice_distance += fixed_difference.choice_distance;
+		fixed_total.max_choice_distance = max(fixed_total.max_choice_distance, fixed_difference.max_choice_distance);
+	}
+	printf("All samples, %zu observations\n", observations);
+	float_total.print("float", observations);
+	fixed_total.print("fixed", observations);
+}
+
+int main(int argc, char* argv[]) {
+	benchmark();
+	selectionDifference(argc > 1 ? atoi(argv[1]) : 10);
+	return 0;
+}
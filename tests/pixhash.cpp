@@ -0,0 +1,21 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/image.h"
+
+// Prints the 64-bit FNV-1a of the pixels, the size and the file name of every image, so outputs are compared
+// whatever their encoding
+int main(int argc, char* argv[]) {
+	for (int a = 1; a < argc; a++) {
+		Image image = LoadImage(argv[a]);
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(image.rawData());
+		unsigned long long hash = 0xCBF29CE484222325ULL;
+		for (size_t k = 0; k < image.getHeight() * image.getWidth() * sizeof(RGB); k++) {
+			hash ^= data[k];
+			hash *= 0x100000001B3ULL;
+		}
+		const char* name = strrchr(argv[a], '/');
+		printf("%016llx %zux%zu %s\n", hash, image.getWidth(), image.getHeight(), name != nullptr ? name + 1 : argv[a]);
+	}
+	return 0;
+}